@@ -9,11 +9,35 @@
 /* -------------------------------------------------------------------------- */
 
 /* -------------------------------- #includes ------------------------------- */
+#define _POSIX_C_SOURCE 200809L     // for clock_gettime, opendir, mmap and
+                                    // sockets
+#define _DEFAULT_SOURCE             // for syscall (hardware counters)
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <math.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
 
 /* -------------------------------- #defines -------------------------------- */
 #define TITLE "_________ .__                   __         \n\
@@ -39,9 +63,135 @@
 #define COST_TOWER          3       // one tower cost
 #define TREE_DEPTH          3       // minimax tree depth
 #define ROOT_DEPTH          0       // the root depth
+#define MAX_DEPTH           64      // deepest iteration with a time/node limit
+#define CHECK_INTERVAL      1023    // check the limits every 1024 nodes
+#define MAX_PLY             (MAX_DEPTH + 1) // most plies of one search
+#define MAX_MOVES           64      // most valid actions (12 pieces x 4 dirs)
+
+// move ordering (higher scores are searched first)
+#define NUM_KILLERS         2       // killer actions remembered at each depth
+#define SCORE_HASH          (1 << 30)   // best action found before
+#define SCORE_CAPTURE       (1 << 29)   // captures
+#define SCORE_PROMOTION     (1 << 28)   // pieces turning into towers
+#define SCORE_KILLER        (1 << 27)   // actions that pruned a sibling
+#define MAX_HISTORY         (1 << 26)   // history scores are halved above it
+
+// transposition table
+#define HASH_MB             16      // default transposition table size (MB)
+#define BUCKET_SIZE         2       // entries per bucket (deepest, newest)
+#define ZOBRIST_SEED        0x9E3779B97F4A7C15ULL
+#define BOUND_LOWER         1       // cost is at least the stored cost
+#define BOUND_UPPER         2       // cost is at most the stored cost
+#define BOUND_EXACT         3       // cost is exactly the stored cost
+#define BOUND_BITS          2       // low bits of the flags holding the bound
+#define NO_MOVE             0       // no best action stored
+#define NUM_PIECE_TYPES     4       // white/black pieces and towers
+
+// parallel search
+#define MAX_THREADS         64      // most search threads
+#define SCALING_DEPTH       10      // default depth of the scaling report
+
+// benchmarks
+#define BENCH_DEPTH         10      // default depth of the benchmark
+#define NUM_BENCH_FILES     10      // number of default benchmark positions
+#define BENCH_FILES         {"testcases/test0.txt", "testcases/test1.txt", \
+                             "testcases/test2.txt", "testcases/test3.txt", \
+                             "testcases/test4.txt", "testcases/test5.txt", \
+                             "testcases/test6.txt", "testcases/test7.txt", \
+                             "testcases/test8.txt", "testcases/test10.txt"}
+
+// batch analysis
+#define MAX_PATH_LEN        4096    // longest path in a batch manifest
+#define GAME_EXT            ".txt"  // extension of the games in a directory
+#define GAME_OUT_EXT        "-out.txt"  // expected outputs, not games
+#define NO_WINNER           -1
+
+// binary game records: a header (magic, version, flags), then per game one
+// byte per ply (square, direction and whether it jumps), optionally followed
+// by the hash and cost of the board after it, and RECORD_END and the command
+#define RECORD_MAGIC        "CKGR"
+#define RECORD_MAGIC_LEN    4
+#define RECORD_VERSION      1
+#define RECORD_EVALS        1       // flag: a hash and cost follow every ply
+#define RECORD_END          0x00    // ends a game (B1 cannot move north-east)
+#define RECORD_COMPUTED     0x01    // later plies were computed (D1 neither)
+#define RECORD_JUMP         0x80    // the ply is a jump
+#define RECORD_DIR_SHIFT    5       // the direction is stored above the square
+#define RECORD_SQUARE_MASK  0x1F
+#define HASH_BYTES          8
+#define COST_BYTES          4
+#define GAME_FILE_FORMAT    "%s/game%06llu.txt"
+
+// endgame database: win/loss distances of every board with few pieces,
+// one table (slice) per number of pieces of each type, stored compressed
+#define EGDB_MAGIC          "CKEG"
+#define EGDB_VERSION        2
+#define EGDB_MAX_PIECES     5       // most pieces of a database
+#define EGDB_PIECES         3       // default pieces of a new database
+#define EGDB_SIGNATURES     1296    // (EGDB_MAX_PIECES+1) ^ NUM_PIECE_TYPES
+#define EGDB_DRAW           0       // value of draws (and unknown boards)
+#define EGDB_MAX_VALUE      UINT8_MAX   // other values are the distance + 1
+#define EGDB_WIN_COST       1000000 // cost of a win, minus its distance
+#define EGDB_BLOCK_LEN      4096    // values per separately compressed block
+#define EGDB_LITERAL        0x80    // compressed: flags a run of literals
+#define EGDB_RUN_LEN        0x80    // longest run (or literals) of one byte
+#define EGDB_MIN_RUN        3       // shortest run worth a count
+#define EGDB_CHUNK_LEN      4096    // boards per task of a generation thread
+#define EGDB_ALIGN          8       // alignment of the block offsets
+
+// opening book: the best action of boards near the start of a game, sorted
+// by the board's hash to be found by binary search
+#define BOOK_MAGIC          "CKBK"
+#define BOOK_VERSION        1
+#define BOOK_PLIES          8       // default number of plies of a new book
+
+// engine server: one request per line, "session command [args]"
+#define SERVER_LINE_LEN     65536   // longest request
+#define SERVER_REPLY_LEN    256     // longest reply to a go request
+#define SESSION_NAME_LEN    32      // longest session name
+#define MAX_SESSIONS        1024    // most sessions served at once
+#define SERVER_BACKLOG      16      // connections waiting to be accepted
+#define TOKEN_DELIMITERS    " \t\r\n"
+#define START_POSITION      "start" // set-position argument for a new game
+#define REQ_SET_POSITION    "set-position"
+#define REQ_APPLY_MOVES     "apply-moves"
+#define REQ_GO              "go"
+#define REQ_STOP            "stop"
+#define REQ_STATS           "stats"
+#define REQ_CLOSE           "close"
+#define REQ_QUIT            "quit"
+#define GO_DEPTH            "depth"
+#define GO_TIME             "time"
+#define GO_NODES            "nodes"
+
+// self-play tournament
+#define OPENING_PLIES       4       // random actions before a game starts
+#define DRAW_PLIES          40      // tower steps in a row that draw a game
+#define MAX_ENGINE_ARGS     64      // most options of an engine
+#define ENGINE_SHELL        "/bin/sh"
+#define ELO_SCALE           400.0   // Elo points per factor of 10 in odds
+#define Z_95                1.96    // z-score of a 95% confidence interval
+#define RESULT_NAMES        {"loss", "draw", "win"}
+#define END_NAMES           {"no actions", "search", "draw rule", "illegal"}
+#define END_NO_ACTIONS      0       // the side to move has no valid action
+#define END_SEARCH          1       // a search found a forced win
+#define END_DRAW_RULE       2       // only towers moved for DRAW_PLIES plies
+#define END_ILLEGAL         3       // an engine played an illegal action
+
+// results of reading a ply of a binary game record
+#define PLY_ERROR           -1      // the record is damaged or illegal
+#define PLY_EOF             0       // no more games
+#define PLY_GAME_END        1       // the game ended, its command is stored
+#define PLY_MOVE            2
+
+// results of replaying a game file
+#define REPLAY_ERROR        -1      // the file could not be read
+#define REPLAY_ILLEGAL      0       // stopped at an illegal action
+#define REPLAY_OK           1
 
 #define P_COMP_ACTIONS      10      // number of computed actions for P command
 #define A_COMP_ACTIONS      1       // number of computed actions for A command
+#define MULTI_PV_ALL        0       // the M command ranks every valid action
 
 // inputting
 #define NEWLINE_CHAR        '\n'    // marks the end of an action or command
@@ -49,6 +199,14 @@
 #define ACTION_LEN          4
 #define COMMAND_LEN         1
 #define TEMP                "XXXX"  // temporary action placeholder
+#define CARRIAGE_RETURN     '\r'    // ignored, for files with CRLF lines
+#define INPUT_BUFFER_LEN    65536   // characters read from the input at once
+
+// results of reading a line of input
+#define PARSE_ERROR         -1      // the line is not an action or command
+#define PARSE_END           0       // the end of the input
+#define PARSE_ACTION        1
+#define PARSE_COMMAND       2
 
 // action array positions
 #define SRC_COL             0
@@ -64,6 +222,42 @@
 #define CELL_DIVIDER        "|"
 #define ROW_DIVIDER         "   +---+---+---+---+---+---+---+---+\n"
 #define COMPUTED_MARKER     "*** "
+#define ROW_LABEL_LEN       3       // " 1 " in front of every row
+#define CELL_LEN            4       // "| . " for every cell
+#define ROW_LEN             (ROW_LABEL_LEN + BOARD_SIZE*CELL_LEN + 2)
+#define BOARD_TEXT_LEN      (sizeof(COL_DISPLAY) - 1 + BOARD_SIZE*ROW_LEN \
+                            + (BOARD_SIZE+1) * (sizeof(ROW_DIVIDER) - 1))
+#define ACTION_TEXT_LEN     128     // longest text printed above a board
+
+// output levels
+#define OUTPUT_SUMMARY      0       // only the final board
+#define OUTPUT_ACTIONS      1       // every action without its board
+#define OUTPUT_FULL         2       // every action and board
+#define OUTPUT_NAMES        {"summary", "actions", "full"}
+
+// reports of each computed action (on stderr)
+#define STATS_NONE          0
+#define STATS_TEXT          1       // one line of text per search
+#define STATS_JSON          2       // one JSON object per search
+#define STATS_NAMES         {"none", "text", "json"}
+
+// search counters, compiled out with -DNO_STATS (except for the node count,
+// which the node and time limits need)
+#ifdef NO_STATS
+#define COUNT(search, counter)  ((void)0)
+#else
+#define COUNT(search, counter)  ((search)->stats.counter++)
+#endif
+
+// colour specialization: the search core takes the player as an argument but
+// is inlined into one copy for each colour, so every colour check is resolved
+// at compile time; -DNO_SPECIALIZATION keeps a single copy that checks the
+// colour at runtime (to compare the two)
+#ifdef NO_SPECIALIZATION
+#define SPECIALIZED         __attribute__((noinline))
+#else
+#define SPECIALIZED         inline __attribute__((always_inline))
+#endif
 
 // players
 #define NUM_PLAYERS         2
@@ -90,9 +284,95 @@
 #define B_TOW_ROW           '1'     // row for black pieces turn into towers
 #define W_TOW_ROW           '8'     // row for white pieces turn into towers
 
+// bitboard (the 32 checkered cells, numbered in row-major order)
+#define NUM_SQUARES         32      // number of checkered cells
+#define SQUARES_PER_ROW     4       // number of checkered cells in each row
+#define EVEN_ROWS           0x0F0F0F0FU // cells on rows 1, 3, 5 and 7
+#define ODD_ROWS            0xF0F0F0F0U // cells on rows 2, 4, 6 and 8
+#define WHITE_START         0x00000FFFU // cells with white pieces initially
+#define BLACK_START         0xFFF00000U // cells with black pieces initially
+#define EMPTY_START         0x000FF000U // cells that are empty initially
+#define SQUARE_BIT(sq)      ((bitboard_t)1 << (sq))
+#define SQUARE_ROW(sq)      ((sq) / SQUARES_PER_ROW)
+#define ROW_BITS(row)       ((bitboard_t)0x0F << ((row)*SQUARES_PER_ROW))
+#define MAX_SIDE_PIECES     (ROWS_WITH_PIECES*SQUARES_PER_ROW)  // per player
+#define SQUARE_COL(sq)      (2*((sq) % SQUARES_PER_ROW) \
+                                + (SQUARE_ROW(sq) + 1) % 2)
+#define ENCODE_MOVE(src, tar)   ((move_t)((src)*NUM_SQUARES + (tar)))
+#define MOVE_SRC(move)      ((move) / NUM_SQUARES)
+#define MOVE_TAR(move)      ((move) % NUM_SQUARES)
+#define NO_PIECE            -1      // no piece was captured
+#define NO_SQUARE           -1      // off the board, or not a capture
+#define SHIFT(b, n)         ((n) > 0 ? (b) << (n) : (b) >> -(n))
+
+// bitboard directions (in the order actions are generated)
+#define NUM_DIRS            4
+#define DIR_NE              0
+#define DIR_SE              1
+#define DIR_SW              2
+#define DIR_NW              3
+
+// command line options
+#define OPT_HASH            "-H"    // transposition table size in MB
+#define OPT_VERBOSE         "-v"    // print search statistics to stderr
+#define OPT_DEPTH           "-d"    // minimax tree depth
+#define OPT_TIME            "-t"    // time limit per computed action (ms)
+#define OPT_NODES           "-n"    // node limit per computed action
+#define OPT_THREADS         "-j"    // number of search threads
+#define OPT_OUTPUT          "-o"    // output level
+#define OPT_RECORD          "-r"    // write a binary record of the game
+#define OPT_RECORD_EVALS    "-e"    // add hashes and costs to binary records
+#define OPT_ENDGAME         "-g"    // endgame database to probe
+#define OPT_BOOK            "-b"    // opening book to look actions up in
+#define OPT_QUIESCENCE      "-q"    // extend captures past the deepest depth
+#define OPT_PONDER          "-p"    // search during the human's turn (mode 1)
+#define OPT_STATS           "-s"    // report each computed action's search
+#define OPT_MULTI_PV        "-k"    // number of actions ranked by M
+#define USAGE               "usage: checkers [-d depth] [-t time_ms] " \
+                            "[-n nodes] [-j threads] [-H hash_mb] [-v] " \
+                            "[-o full|actions|summary] [-r record] [-e] " \
+                            "[-g endgame_db] [-b book] [-q] [-p] " \
+                            "[-s text|json] [-k actions] " \
+                            "[command [args]]\n" \
+                            "commands:\n" \
+                            "  scaling [depth]   nodes/sec with 1 to " \
+                            "`threads` threads\n" \
+                            "  perft depth [files...]   count the leaf nodes " \
+                            "of each depth\n" \
+                            "  bench [depth [files...]]   search a fixed " \
+                            "set of positions\n" \
+                            "  batch dir|manifest   analyse many games, " \
+                            "`threads` at a time\n" \
+                            "  encode record files...   convert action " \
+                            "lists to a binary record\n" \
+                            "  decode record [dir]   convert a binary " \
+                            "record to action lists\n" \
+                            "  endgame file [pieces]   generate the endgame " \
+                            "database of boards with up to `pieces` " \
+                            "(default 3, at most 5)\n" \
+                            "  book file [plies [files...]]   build an " \
+                            "opening book by self-play or from games\n" \
+                            "  serve [socket]   answer engine requests on " \
+                            "stdin or a unix socket\n" \
+                            "  tournament games [engine_a [engine_b]]   " \
+                            "play engines against each other\n"
+
+// commands
+#define CMD_SCALING         "scaling"
+#define CMD_PERFT           "perft"
+#define CMD_BENCH           "bench"
+#define CMD_BATCH           "batch"
+#define CMD_ENCODE          "encode"
+#define CMD_DECODE          "decode"
+#define CMD_ENDGAME         "endgame"
+#define CMD_BOOK            "book"
+#define CMD_SERVE           "serve"
+#define CMD_TOURNAMENT      "tournament"
+
 // command characters
 #define A_COMMAND           'A'
 #define P_COMMAND           'P'
+#define M_COMMAND           'M'     // rank the best actions of the board
 
 // error messages
 #define ERROR1              "ERROR: Source cell is outside of the board.\n"
@@ -101,62 +381,620 @@
 #define ERROR4              "ERROR: Target cell is not empty.\n"
 #define ERROR5              "ERROR: Source cell holds opponent's piece/tower.\n"
 #define ERROR6              "ERROR: Illegal action.\n"
+#define ERROR7              "ERROR: Line %d is not an action or command.\n"
 
 // winning messages
 #define WHITE_WIN           "WHITE WIN!\n"
 #define BLACK_WIN           "BLACK WIN!\n"
 
 /* -------------------------------- typedefs -------------------------------- */
-typedef unsigned char board_t[BOARD_SIZE][BOARD_SIZE];  // board type
+typedef uint32_t bitboard_t;    // one bit per checkered cell
+typedef struct {
+    bitboard_t  pieces[NUM_PLAYERS];    // pieces of each player
+    bitboard_t  towers[NUM_PLAYERS];    // towers of each player
+    bitboard_t  empty;                  // empty checkered cells
+    uint64_t    hash;                   // zobrist hash (with side to move)
+    int         cost;                   // board cost, kept up to date
+} board_t;
+typedef uint16_t move_t;        // source square * NUM_SQUARES + target square
+typedef struct {
+    uint64_t    hash;       // hash of the board before the move
+    int8_t      captured;   // piece type that was captured (or NO_PIECE)
+    int8_t      promoted;   // TRUE if the piece turned into a tower
+} undo_t;
+typedef struct {
+    uint64_t    key;        // zobrist hash of the position
+    int32_t     cost;       // cost found for the position
+    move_t      move;       // best action found for the position
+    uint8_t     depth;      // remaining depth the cost was searched to
+    uint8_t     flags;      // bound type and search generation
+} tt_entry_t;
+typedef struct {
+    // an entry is stored as its packed data and the key xor'ed with the data,
+    // so an entry torn by two threads writing at once never matches its key
+    _Atomic uint64_t    check;
+    _Atomic uint64_t    data;
+} tt_slot_t;
+typedef struct {
+    tt_slot_t   *buckets;   // BUCKET_SIZE entries per bucket
+    uint64_t    mask;       // number of buckets - 1
+    _Atomic uint8_t generation; // incremented with every search
+} trans_table_t;
+typedef struct {
+    uint64_t    nodes;      // number of nodes visited
+    uint64_t    tt_probes;  // number of transposition table lookups
+    uint64_t    tt_hits;    // lookups that found the position
+    uint64_t    tt_cutoffs; // hits that ended the search of the position
+    uint64_t    tt_stores;  // number of stored positions
+    uint64_t    searches;   // number of computed actions
+    uint64_t    allocations;    // heap allocations made while searching
+    uint64_t    cutoffs;    // nodes whose remaining actions were pruned
+    uint64_t    first_cutoffs;  // cutoffs caused by the first action
+    uint64_t    egdb_hits;  // boards found in the endgame database
+    uint64_t    book_hits;  // computed actions found in the opening book
+    uint64_t    qnodes;     // nodes visited by the quiescence search
+    uint64_t    pv_hits;    // searches continued from the last one's line
+    uint64_t    ponders;    // human turns searched during (mode 1)
+    uint64_t    ponder_hits;    // of which the human played the expected reply
+} search_stats_t;
+typedef struct {
+    int         depth;              // deepest completed depth
+    double      time_ms;            // time the whole search took
+    double      depth_ms[MAX_PLY];  // time each depth was completed at
+    uint64_t    depth_nodes[MAX_PLY];   // nodes visited by then
+    search_stats_t stats;           // counters of every thread
+} search_info_t;
+typedef struct {
+    int         hash_mb;    // transposition table size in MB
+    int         verbose;    // print search statistics
+    int         depth;      // deepest minimax tree depth
+    long        time_ms;    // time limit per computed action (0 for none)
+    uint64_t    max_nodes;  // node limit per computed action (0 for none)
+    int         threads;    // number of search threads
+    int         output;     // OUTPUT_FULL, OUTPUT_ACTIONS or OUTPUT_SUMMARY
+    int         stats;      // STATS_NONE, STATS_TEXT or STATS_JSON
+    char        *record;    // binary record of the game to write (or NULL)
+    int         record_flags;   // RECORD_EVALS or 0
+    char        *endgame;   // endgame database to probe (or NULL)
+    char        *book;      // opening book to look actions up in (or NULL)
+    int         quiescence; // extend captures past the deepest depth
+    int         ponder;     // search during the human's turn (mode 1)
+    int         multi_pv;   // actions ranked by M (MULTI_PV_ALL for all)
+    atomic_int  *stop;      // ends the search once set (or NULL)
+    char        *command;   // command to run instead of a game (or NULL)
+    char        **args;     // arguments of the command
+    int         num_args;
+} options_t;
+typedef struct {
+    long        time_ms;    // time limit of the search (0 for none)
+    uint64_t    max_nodes;  // node limit of the search (0 for none)
+    double      start_ms;   // time the search started
+    atomic_int  *abort;     // set once the main thread's search is over
+    atomic_int  *stop;      // ends the search once set (or NULL)
+    int         completed;  // deepest fully searched depth
+    int         stopped;    // TRUE once a limit is reached
+    int         quiescence; // extend captures past the deepest depth
+    uint64_t    variant;    // xor'ed into transposition table keys
+    move_t      root_move;  // best action at the root of the last depth
+    search_stats_t stats;   // counters of this search
+    move_t      moves[MAX_PLY][MAX_MOVES];  // valid actions at each depth
+    int         scores[MAX_PLY][MAX_MOVES]; // their move ordering scores
+    move_t      root_order[MAX_MOVES];  // root actions in generated order
+    move_t      killers[MAX_PLY][NUM_KILLERS];  // actions that pruned
+    int         history[NUM_PLAYERS][NUM_SQUARES*NUM_SQUARES];
+                // how often each action pruned, weighted by depth
+} search_t;
+typedef struct {
+    // the principal variation of the last search: the board before each of
+    // its actions, and the cost and depth that action was searched to
+    int         pv_len;
+    uint64_t    hashes[MAX_PLY];
+    move_t      pv[MAX_PLY];
+    int         costs[MAX_PLY];
+    int         depths[MAX_PLY];
+    move_t      killers[MAX_PLY][NUM_KILLERS];  // its move ordering tables
+    int         history[NUM_PLAYERS][NUM_SQUARES*NUM_SQUARES];
+} search_memory_t;
 typedef char action_t[ACTION_LEN+1];
-typedef struct node node_t;
-struct node {
+typedef struct {
+    FILE        *stream;
+    int         is_interactive; // read a line at a time (for a human)
+    char        buffer[INPUT_BUFFER_LEN];
+    size_t      pos;            // next character of the buffer to parse
+    size_t      len;            // number of characters in the buffer
+    int         line;           // number of lines parsed
+} input_t;
+typedef struct {
     action_t    action;
     int         cost;
-    node_t      *next;
-};
+} node_t;
+typedef struct {
+    move_t      move;       // root action
+    int         cost;       // its cost, or a bound on it if not exact
+    int         is_exact;   // FALSE if it is not among the best actions
+    int         index;      // its index in generated order (wins ties)
+    int         pv_len;
+    move_t      pv[MAX_PLY];    // its principal variation, from the action
+} ranked_action_t;
+typedef struct {
+    board_t     board;      // the board after the expected reply
+    options_t   options;    // options of the search, without limits
+    search_memory_t memory; // the search, to continue from
+    node_t      *best_action;   // its action if it searched every depth
+    search_info_t info;     // and the counters of that search
+    atomic_int  stop;       // set once the human's action is in
+    pthread_t   thread;
+} ponder_t;
+typedef struct {
+    int         id;         // 0 for the main thread, 1+ for helper threads
+    board_t     board;      // the thread's own copy of the board
+    int         player;
+    int         max_depth;
+    search_t    search;
+    move_t      best_move;  // best action of its deepest completed search
+    int         best_cost;
+    double      depth_ms[MAX_PLY];  // time each depth was completed at
+    uint64_t    depth_nodes[MAX_PLY];   // nodes visited by then
+} worker_t;
+typedef struct {
+    char        magic[RECORD_MAGIC_LEN];
+    uint32_t    version;
+    uint32_t    max_pieces;
+    uint32_t    num_slices;
+} egdb_header_t;    // a multiple of EGDB_ALIGN, as the slices follow it
+typedef struct {
+    uint8_t     counts[NUM_PIECE_TYPES];    // pieces of each type
+    uint32_t    num_blocks;
+    uint64_t    num_boards;     // number of piece placements
+    uint64_t    offset;         // file offset of the block offsets
+} egdb_slice_t;
+typedef struct {
+    uint8_t     *map;           // the memory-mapped file (NULL if none)
+    size_t      size;
+    int         max_pieces;
+    egdb_slice_t *slice_of[EGDB_SIGNATURES];    // slices by their signature
+} endgame_db_t;
+typedef struct {
+    char        magic[RECORD_MAGIC_LEN];
+    uint32_t    version;
+    uint64_t    num_entries;
+} book_header_t;
+typedef struct {
+    uint64_t    hash;           // zobrist hash of the board
+    move_t      move;           // an action for the board
+    uint16_t    weight;         // how often the action was played
+    int32_t     cost;           // cost found for the action
+} book_entry_t;
+typedef struct {
+    uint8_t     *map;           // the memory-mapped file (NULL if none)
+    size_t      size;
+    book_entry_t *entries;      // sorted by hash, then action
+    uint64_t    num_entries;
+} opening_book_t;
+typedef struct {
+    book_entry_t *entries;
+    uint64_t    num_entries;
+    uint64_t    capacity;
+    int         max_plies;
+    int         engine;         // player whose actions are searched for
+    options_t   *options;
+} book_builder_t;
+typedef struct {
+    int         max_pieces;
+    int         signature;      // slice being generated
+    uint64_t    num_values;     // its boards * NUM_PLAYERS
+    uint8_t     *tables[EGDB_SIGNATURES];   // values of the generated slices
+    uint64_t    num_boards[EGDB_SIGNATURES];    // and their boards
+    uint8_t     *next;          // values of the slice after this pass
+    int         distance;       // distance resolved by this pass
+    int         max_distance;   // longest distance of the generated slices
+    atomic_ullong next_chunk;   // next chunk of boards to resolve
+    atomic_ullong resolved;     // boards resolved by this pass
+} egdb_gen_t;
+typedef struct {
+    FILE        *stream;
+    int         flags;          // RECORD_EVALS or 0
+    int         computed;       // TRUE once the computed plies have started
+} record_writer_t;
+typedef struct {
+    FILE        *stream;
+    int         flags;          // RECORD_EVALS or 0
+    board_t     board;          // board after the plies read so far
+    int         turn;           // turn of the next ply
+    int         computed;       // TRUE if the last ply was computed
+    char        command;        // command of the last finished game
+} record_reader_t;
+typedef struct {
+    char        *path;          // the game file
+    int         status;         // REPLAY_OK, REPLAY_ILLEGAL or REPLAY_ERROR
+    int         plies;          // number of legal actions in the file
+    char        command;        // A_COMMAND, P_COMMAND or DASH
+    int         num_actions;    // number of computed actions
+    action_t    actions[P_COMP_ACTIONS];
+    int         winner;         // BLACK, WHITE or NO_WINNER
+    int         cost;           // cost of the last computed action
+    uint64_t    nodes;          // nodes searched for the computed actions
+    double      time_ms;
+} game_record_t;
+typedef struct {
+    game_record_t *records;
+    int         num_records;
+    atomic_int  next;           // index of the next game to analyse
+    options_t   *options;       // search options of every game
+} batch_t;
 typedef struct {
-    node_t      *head;
-    node_t      *foot;
-} list_t;
+    FILE        *in;
+    FILE        *out;
+    pthread_mutex_t lock;       // held while writing a reply
+    void        *server;        // the server_t it belongs to
+    int         num_searching;  // searches replying to it, by server lock
+    char        line[SERVER_LINE_LEN];
+    char        reply[SERVER_LINE_LEN + SERVER_REPLY_LEN];  // to the line
+} connection_t;
+typedef struct {
+    char        name[SESSION_NAME_LEN+1];
+    board_t     board;
+    int         player;         // side to move
+    search_memory_t memory;     // the last search, to continue from
+    options_t   options;        // options of the queued or running search
+    atomic_int  stop;           // ends the running search once set
+    int         is_searching;   // TRUE from go until its reply
+    connection_t *connection;   // where the reply of the search goes
+    uint64_t    searches;
+    uint64_t    nodes;
+    double      time_ms;
+} session_t;
+typedef struct {
+    session_t   *sessions[MAX_SESSIONS];
+    int         num_sessions;
+    session_t   *queue[MAX_SESSIONS];   // sessions waiting for a thread
+    int         queue_head;
+    int         num_queued;
+    int         is_closing;     // set once the pool threads should end
+    pthread_mutex_t lock;       // guards everything above
+    pthread_cond_t changed;     // a search was queued or ended
+    options_t   *options;       // options of every search
+    int         num_threads;
+    pthread_t   threads[MAX_THREADS];
+} server_t;
+typedef struct {
+    char        *spec;      // options, or the command of an engine process
+    char        *argv[MAX_ENGINE_ARGS+1];   // the options, split up
+    options_t   options;    // search options of an engine in this process
+    FILE        *requests;  // requests to an engine process (or NULL)
+    FILE        *replies;
+    pid_t       pid;
+    pthread_mutex_t lock;   // guards the rest
+    pthread_cond_t replied; // a reply was read
+    int         is_reading; // TRUE while a thread waits for the next reply
+    int         has_ended;  // TRUE once the engine process stopped replying
+    int         has_reply[MAX_THREADS];
+    char        reply[MAX_THREADS][SERVER_REPLY_LEN];  // by session (thread)
+} engine_t;
+typedef struct {
+    int         result;     // 0, 1 or 2 for a loss, draw or win of engine A
+    int         end;        // END_NO_ACTIONS, END_SEARCH, ... END_ILLEGAL
+    int         plies;
+    action_t    opening[OPENING_PLIES];
+} match_game_t;
+typedef struct {
+    engine_t    engines[NUM_PLAYERS];   // engine A and engine B
+    match_game_t *games;
+    int         num_games;
+    atomic_int  next;       // index of the next game to play
+    atomic_int  next_slot;  // session number of the next thread
+} tournament_t;
+
+/* ---------------------------- Bitboard Tables ----------------------------- */
+// square offsets of a one step move from cells on even and odd rows
+static const int STEP_EVEN[NUM_DIRS] = {-3, 5, 4, -4};
+static const int STEP_ODD[NUM_DIRS]  = {-4, 4, 3, -5};
+// square offsets of a capture (the same from every row)
+static const int JUMP[NUM_DIRS]      = {-7, 9, 7, -9};
+// cells that stay on the board after a one step move or a capture
+static const bitboard_t STEP_MASK[NUM_DIRS] = {
+    0xF7F7F7F0U, 0x07F7F7F7U, 0x0FEFEFEFU, 0xEFEFEFE0U};
+static const bitboard_t JUMP_MASK[NUM_DIRS] = {
+    0x77777700U, 0x00777777U, 0x00EEEEEEU, 0xEEEEEE00U};
+// row and column steps of each direction
+static const int DIR_ROWS[NUM_DIRS]  = {NORTH, SOUTH, SOUTH, NORTH};
+static const int DIR_COLS[NUM_DIRS]  = {EAST, EAST, WEST, WEST};
+// directions that pieces (not towers) may move in for each player
+static const int IS_FORWARD[NUM_PLAYERS][NUM_DIRS] = {
+    {FALSE, TRUE, TRUE, FALSE},     // white pieces move south
+    {TRUE, FALSE, FALSE, TRUE}};    // black pieces move north
+// row that each player's pieces turn into towers on
+static const int TOWER_ROW[NUM_PLAYERS] = {
+    W_TOW_ROW+ROW_OFFSET, B_TOW_ROW+ROW_OFFSET};
+// cost of each piece type (white/black pieces, then white/black towers)
+static const int TYPE_COST[NUM_PIECE_TYPES] = {
+    -COST_PIECE, COST_PIECE, -COST_TOWER, COST_TOWER};
+
+// squares reached from each square with a one step move and a capture in each
+// direction, the square the capture jumps over (NO_SQUARE if it leaves the
+// board) and the square each move captures on (NO_SQUARE for one step moves),
+// filled in by init_move_tables
+static int8_t step_squares[NUM_SQUARES][NUM_DIRS];
+static int8_t jump_squares[NUM_SQUARES][NUM_DIRS];
+static int8_t jumped_squares[NUM_SQUARES][NUM_DIRS];
+static int8_t move_captures[NUM_SQUARES*NUM_SQUARES];
+
+/* -------------------------- Transposition Table --------------------------- */
+// random keys for each piece type on each square, for white to move and for
+// searches with quiescence (whose costs differ from those without)
+static uint64_t zobrist_cells[NUM_PIECE_TYPES][NUM_SQUARES];
+static uint64_t zobrist_side;
+static uint64_t zobrist_quiescence;
+// costs of already searched positions, shared by every search and thread
+static trans_table_t trans_table;
+// counters of every search so far
+static search_stats_t search_stats;
+static pthread_mutex_t search_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+// number of heap allocations made with counted_malloc by each thread, so a
+// search only counts its own threads' allocations
+static _Thread_local uint64_t thread_allocations;
+
+/* ---------------------------- Endgame Database ---------------------------- */
+// number of ways to choose k of n squares
+static uint64_t binomials[NUM_SQUARES+1][EGDB_MAX_PIECES+1];
+// the memory-mapped database probed by the search
+static endgame_db_t endgame_db;
+// the memory-mapped opening book consulted before searching
+static opening_book_t opening_book;
 
 /* --------------------------- Function Prototypes -------------------------- */
 // functions used for inputting and printing
-int get_action(action_t action, char *command);
-void initial_setup(board_t board);
-void print_board(board_t board);
-void print_action(action_t action, int turn_count, board_t board,
-    int is_computed);
-int count_type(board_t board, char type);
-int calculate_cost(board_t board);
+void init_input(input_t *input, FILE *stream, int is_interactive);
+int fill_input(input_t *input);
+int get_action(input_t *input, action_t action, char *command);
+void initial_setup(board_t *board, int output);
+void fill_initial_board(board_t *board);
+void print_board(board_t *board);
+int render_board(board_t *board, char *text);
+void print_action(action_t action, int turn_count, board_t *board,
+    int is_computed, int output);
+void print_summary(board_t *board, int turn_count);
+void print_ranking(ranked_action_t *ranked, int num_ranked, int turn_count,
+    int depth);
+int display_cost(board_t *board);
+int count_type(board_t *board, char type);
+int calculate_cost(board_t *board);
+int count_cost(board_t *board);
+
+// functions related to the bitboard
+char get_cell(board_t *board, int row, int col);
+int cell_to_square(int row, int col);
+void square_to_cell(int sq, char *col, char *row);
+bitboard_t step_back(bitboard_t cells, int dir);
+void init_move_tables(void);
+int square_at(int row, int col);
+int count_bits(bitboard_t bits);
+int first_bit(bitboard_t bits);
+
+// functions related to the transposition table
+void init_zobrist(void);
+uint64_t hash_board(board_t *board);
+void tt_init(int hash_mb);
+void tt_free(void);
+void tt_clear(void);
+void tt_new_search(void);
+int tt_probe(uint64_t key, tt_entry_t *entry);
+void tt_store(uint64_t key, int depth, int bound, int cost, move_t move);
+void tt_report(FILE *stream);
+move_t action_to_move(action_t action);
+void move_to_action(move_t move, action_t action);
+int read_options(int argc, char *argv[], options_t *options);
 
 // functions related to doing or checking actions
-int is_action_legal(board_t board, action_t action, int player,
+int is_action_legal(board_t *board, action_t action, int player,
     int is_printing);
-void do_action(board_t board, action_t action, int player);
+void do_action(board_t *board, action_t action, int player);
+void make_move(board_t *board, move_t move, int player, undo_t *undo);
+void unmake_move(board_t *board, move_t move, int player, undo_t *undo);
+bitboard_t *type_cells(board_t *board, int type);
 
 // functions related to minimax
-node_t *minimax(int depth, int max_depth, board_t board, int player, 
-    node_t *node);
-list_t *get_valid_actions(board_t board, int player, list_t *valid_actions);
-list_t *get_valid_action_in_dir(int col, int row, int y, int x, int player, 
-    board_t board, list_t *valid_actions);
-void copy_board(board_t board, board_t board_copy);
-
-// functions related to linked lists
+node_t *iterative_deepening(board_t *board, int player, options_t *options,
+    search_memory_t *memory, search_info_t *info);
+void *search_worker(void *arg);
+void setup_search(search_t *search, options_t *options, atomic_int *abort,
+    double start_ms);
+int rank_actions(board_t *board, int player, options_t *options,
+    ranked_action_t *ranked, search_info_t *info);
+int is_ranked_before(ranked_action_t *a, ranked_action_t *b, int player);
+move_t pv_move(board_t *board, int player, int depth, uint64_t variant,
+    int *cost);
+void remember_search(search_memory_t *memory, board_t *board,
+    worker_t *worker);
+int recall_search(search_memory_t *memory, board_t *board, search_t *search);
+void add_stats(search_stats_t *total, search_stats_t *stats);
+void search_report(FILE *stream);
+void print_search_info(FILE *stream, int turn, node_t *best_action,
+    search_info_t *info, int format);
+int minimax(search_t *search, int depth, int max_depth, board_t *board,
+    int player, int alpha, int beta);
+int minimax_black(search_t *search, int depth, int max_depth, board_t *board,
+    int alpha, int beta);
+int minimax_white(search_t *search, int depth, int max_depth, board_t *board,
+    int alpha, int beta);
+int minimax_node(search_t *search, int depth, int max_depth, board_t *board,
+    int player, int alpha, int beta);
+int quiescence(search_t *search, board_t *board, int player, int alpha,
+    int beta);
+int quiescence_black(search_t *search, board_t *board, int alpha, int beta);
+int quiescence_white(search_t *search, board_t *board, int alpha, int beta);
+int quiescence_node(search_t *search, board_t *board, int player, int alpha,
+    int beta);
+int is_limit_reached(search_t *search);
+double now_ms(void);
+int get_valid_actions(board_t *board, int player, move_t *moves);
+int get_captures(board_t *board, int player, move_t *moves);
+int generate_actions(board_t *board, int player, move_t *moves,
+    int captures_only);
+void score_moves(search_t *search, board_t *board, int player, int depth,
+    move_t hash_move, move_t *moves, int *scores, int num_moves);
+void pick_move(move_t *moves, int *scores, int index, int num_moves);
+void update_ordering(search_t *search, board_t *board, int player, int depth,
+    int remaining, move_t move);
+int is_capture(move_t move);
+int is_promotion(board_t *board, int player, move_t move);
+int generated_index(search_t *search, int num_moves, move_t move);
+
+// functions related to pondering
+int start_pondering(ponder_t *ponder, board_t *board, options_t *options,
+    search_memory_t *memory);
+void *ponder_worker(void *arg);
+node_t *stop_pondering(ponder_t *ponder, board_t *board,
+    search_memory_t *memory);
+
+// functions related to binary game records
+int open_record_writer(record_writer_t *writer, char *path, int flags);
+void write_ply(record_writer_t *writer, move_t move, board_t *board,
+    int is_computed);
+void end_game_record(record_writer_t *writer, char command);
+int close_record_writer(record_writer_t *writer);
+int open_record_reader(record_reader_t *reader, char *path);
+int read_ply(record_reader_t *reader, move_t *move);
+void close_record_reader(record_reader_t *reader);
+uint8_t encode_move(move_t move);
+move_t decode_move(uint8_t code);
+void write_le(FILE *stream, uint64_t value, int num_bytes);
+int read_le(FILE *stream, uint64_t *value, int num_bytes);
+
+// functions related to the endgame database
+void init_binomials(void);
+int egdb_signature(int *counts);
+uint64_t egdb_num_boards(int *counts);
+uint64_t egdb_rank(board_t *board, int *signature);
+void egdb_unrank(uint64_t index, int *counts, board_t *board);
+int egdb_open(char *path);
+int egdb_check_slice(egdb_slice_t *slice, uint32_t max_pieces, uint8_t *map,
+    size_t size);
+void egdb_close(void);
+int egdb_probe(board_t *board, int player, int *value);
+int egdb_cost(int value, int player);
+int egdb_best_move(board_t *board, int player, move_t *best_move, int *cost);
+int run_endgame(options_t *options);
+void egdb_generate_slice(egdb_gen_t *gen, int *counts, int threads);
+void *egdb_worker(void *arg);
+int egdb_resolve(egdb_gen_t *gen, uint64_t value_index);
+size_t egdb_compress(uint8_t *values, uint64_t num_values, uint64_t *offsets,
+    uint8_t *data);
+uint64_t egdb_run_length(uint8_t *values, uint64_t i, uint64_t max);
+
+// functions related to the opening book
+int book_open(char *path);
+void book_close(void);
+int book_probe(board_t *board, int player, move_t *best_move, int *cost);
+int run_book(options_t *options);
+void book_self_play(book_builder_t *builder, board_t *board, int player,
+    int ply);
+void book_add(book_builder_t *builder, uint64_t hash, move_t move, int cost);
+int compare_book_entries(const void *a, const void *b);
+
+// functions related to commands
+int run_command(options_t *options);
+int run_scaling_report(options_t *options);
+int run_perft(options_t *options);
+int open_branch_counter(void);
+uint64_t read_branch_counter(int counter);
+uint64_t perft(board_t *board, int player, int depth);
+uint64_t perft_black(board_t *board, int depth);
+uint64_t perft_white(board_t *board, int depth);
+uint64_t perft_node(board_t *board, int player, int depth);
+int run_bench(options_t *options);
+int replay_game(char *path, board_t *board, int *turn, char *command);
+int run_batch(options_t *options);
+int read_game_list(char *path, char ***paths);
+int compare_paths(const void *a, const void *b);
+void *batch_worker(void *arg);
+void analyse_game(game_record_t *record, options_t *options);
+void print_record(FILE *stream, game_record_t *record);
+int run_encode(options_t *options);
+int encode_game(char *path, record_writer_t *writer, int *plies);
+int run_decode(options_t *options);
+
+// functions related to the engine server
+int run_serve(options_t *options);
+void *connection_worker(void *arg);
+void serve_connection(server_t *server, connection_t *connection);
+void serve_request(server_t *server, connection_t *connection, char *line);
+session_t *find_session(server_t *server, char *name, int is_creating);
+void close_session(server_t *server, session_t *session);
+int apply_move(session_t *session, char *token);
+int parse_position(char *cells, char *side, board_t *board, int *player);
+int parse_limits(char *rest, options_t *options);
+void *server_worker(void *arg);
+void serve_search(session_t *session, search_info_t *info, char *reply);
+void send_reply(connection_t *connection, const char *format, ...);
+
+// functions related to self-play tournaments
+int run_tournament(options_t *options);
+int is_engine_option(char *option);
+int open_engine(engine_t *engine, char *spec, options_t *options);
+void close_engine(engine_t *engine);
+void *tournament_worker(void *arg);
+void play_match_game(tournament_t *tournament, int index, int slot,
+    match_game_t *game);
+move_t engine_move(engine_t *engine, int slot, board_t *board, int player,
+    search_memory_t *memory, int *cost);
+void engine_request(engine_t *engine, int slot, char *request, char *reply);
+void print_match_game(FILE *stream, int index, match_game_t *game);
+uint64_t next_random(uint64_t *state);
+
+// functions related to memory
 node_t *create_new_node(char *action);
-list_t *make_empty_list(void);
-list_t *insert_at_foot(list_t *list, node_t *new);
-void free_list(list_t *list);
+void *counted_malloc(size_t size);
 
 /* ------------------------------ Main Function ----------------------------- */
 int main (int argc, char *argv[]) {
+    options_t options;
+    if (!read_options(argc, argv, &options)) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    init_zobrist();
+    init_binomials();
+    init_move_tables();
+    tt_init(options.hash_mb);
+    if (options.endgame && !egdb_open(options.endgame)) {
+        fprintf(stderr, "%s: not an endgame database\n", options.endgame);
+        return EXIT_FAILURE;
+    }
+    if (options.book && !book_open(options.book)) {
+        fprintf(stderr, "%s: not an opening book\n", options.book);
+        return EXIT_FAILURE;
+    }
+    if (options.command) {
+        int status = run_command(&options);
+        if (options.verbose) {
+            search_report(stderr);
+        }
+        tt_free();
+        return status;
+    }
+
     printf(TITLE);
 
     // Read in, execute and print actions
     action_t action;
     char command = DASH;    // using the dash as a placeholder
     int turn = 1;
+    static input_t input;
+    static search_memory_t memory;  // the last search, to continue from
+    static ponder_t ponder;         // the search during the human's turn
+
+    // binary record of the game (if asked for)
+    record_writer_t record_writer;
+    record_writer_t *writer = NULL;
+    if (options.record) {
+        if (!open_record_writer(&record_writer, options.record,
+            options.record_flags)) {
+            perror(options.record);
+            return EXIT_FAILURE;
+        }
+        writer = &record_writer;
+    }
     
     // 
     printf("Choose mode ([1] Play with bot, [2] Simulate game): ");
@@ -169,38 +1007,68 @@ int main (int argc, char *argv[]) {
         }
     }
     if (mode == 1) {
+        init_input(&input, stdin, TRUE);
         printf(NEWLINE);
         printf("=================== PLAY WITH BOT MODE ====================\n");
-        printf("  * Human - White Pieces ('W' and 'w')\n"
-                "  * Bot (with MiniMax tree depth %d) - Black Pieces"
-                " ('B' and 'b')\n", TREE_DEPTH);
+        printf("  * Human - White Pieces ('W' and 'w')\n");
+        if (options.time_ms || options.max_nodes) {
+            printf("  * Bot (with MiniMax time limit %ld ms, node limit %llu)"
+                " - Black Pieces ('B' and 'b')\n", options.time_ms,
+                (unsigned long long)options.max_nodes);
+        } else {
+            printf("  * Bot (with MiniMax tree depth %d) - Black Pieces"
+                " ('B' and 'b')\n", options.depth);
+        }
 
         // Initial board setup and printing
         board_t board;
-        initial_setup(board);
+        initial_setup(&board, options.output);
         int game_flag = TRUE;
         
         // Game Loop
+        node_t *pondered_action = NULL; // bot's action found while pondering
         while (game_flag) {
             int player = turn % NUM_PLAYERS;
             if (player == WHITE) {  // human's turn
+                int is_pondering = options.ponder
+                    && start_pondering(&ponder, &board, &options, &memory);
                 printf("Human (White Pieces) Turn - Enter your action"
                 " (eg. B3-C4): ");
-                get_action(action, &command);
-                while (!is_action_legal(board, action, player, TRUE)) {
+                int parsed;
+                while ((parsed = get_action(&input, action, &command))
+                    != PARSE_END) {
+                    if (parsed != PARSE_ACTION) {  // commands are for mode 2
+                        printf(ERROR7, input.line);
+                    } else if (is_action_legal(&board, action, player, TRUE)) {
+                        break;
+                    }
                     printf("Please try again. Enter your action (eg. B3-C4): ");
-                    get_action(action, &command);
                 }
-                do_action(board, action, player);
-                print_action(action, turn, board, FALSE);
+                if (parsed == PARSE_END) {  // no more input
+                    if (is_pondering) {
+                        free(stop_pondering(&ponder, &board, &memory));
+                    }
+                    break;
+                }
+                do_action(&board, action, player);
+                if (is_pondering) {
+                    pondered_action = stop_pondering(&ponder, &board, &memory);
+                }
+                if (writer) {
+                    write_ply(writer, action_to_move(action), &board, FALSE);
+                }
+                print_action(action, turn, &board, FALSE, options.output);
                 turn++;
             } else {    // bot's turn
-                // Find the best action for the current board
-                node_t *best_action = create_new_node(TEMP); 
-                        // starts with a temporary placeholder action
-                best_action = minimax(ROOT_DEPTH, TREE_DEPTH, board, 
-                    player, best_action);
-                        // that is then be replaced by the best action from minimax
+                // Find the best action for the current board, unless it
+                // was already found while the human thought
+                node_t *best_action = pondered_action;
+                search_info_t info = ponder.info;
+                pondered_action = NULL;
+                if (!best_action) {
+                    best_action = iterative_deepening(&board, player,
+                        &options, &memory, &info);
+                }
                 
                 // Check if a player won
                 if (best_action->cost == INT_MAX) {
@@ -214,17 +1082,30 @@ int main (int argc, char *argv[]) {
                 }
 
                 // Perform the best action on the board and print it
-                do_action(board, best_action->action, turn%NUM_PLAYERS);
-                print_action(best_action->action, turn, board, TRUE);
+                do_action(&board, best_action->action, turn%NUM_PLAYERS);
+                if (writer) {
+                    write_ply(writer, action_to_move(best_action->action),
+                        &board, TRUE);
+                }
+                print_action(best_action->action, turn, &board, TRUE,
+                    options.output);
+                if (options.stats) {
+                    print_search_info(stderr, turn, best_action, &info,
+                        options.stats);
+                }
 
                 free(best_action);
                 turn++;
                 
             }
         }
+        if (options.output == OUTPUT_SUMMARY) {
+            print_summary(&board, turn);
+        }
     }
 
     if (mode == 2) {
+        init_input(&input, stdin, FALSE);
         printf("===================== BULK INPUT MODE =====================\n");
         printf("Enter a list of actions (eg. B3-C4) followed by a command \
         [A-predict next move, P-predict next 10 moves]:");
@@ -232,24 +1113,66 @@ int main (int argc, char *argv[]) {
 
         // Initial board setup and printing
         board_t board;
-        initial_setup(board);      
+        initial_setup(&board, options.output);      
 
         // Read in the list of actions and the command
-        while (get_action(action, &command)) {
+        int parsed;
+        while ((parsed = get_action(&input, action, &command)) != PARSE_END
+            && parsed != PARSE_COMMAND) {
             int player = turn % NUM_PLAYERS;
-            if (!is_action_legal(board, action, player, TRUE)) {
-                return EXIT_FAILURE;             // terminate at illegal actions
+            if (parsed == PARSE_ERROR) {
+                printf(ERROR7, input.line);
             }
-            do_action(board, action, player);
-            print_action(action, turn, board, FALSE);
+            if (parsed == PARSE_ERROR
+                || !is_action_legal(&board, action, player, TRUE)) {
+                if (writer) {   // keep the legal part of the game
+                    end_game_record(writer, DASH);
+                    close_record_writer(writer);
+                }
+                return EXIT_FAILURE;    // terminate at invalid/illegal actions
+            }
+            do_action(&board, action, player);
+            if (writer) {
+                write_ply(writer, action_to_move(action), &board, FALSE);
+            }
+            print_action(action, turn, &board, FALSE, options.output);
             turn++;
         }
 
         // no command inputted
         if (command == DASH) {
+            if (options.output == OUTPUT_SUMMARY) {
+                print_summary(&board, turn);
+            }
+            if (writer) {
+                end_game_record(writer, command);
+                close_record_writer(writer);
+            }
+            tt_free();
             return EXIT_SUCCESS;
         }
 
+        // rank the best actions instead of playing any
+        if (command == M_COMMAND) {
+            static ranked_action_t ranked[MAX_MOVES];
+            search_info_t info;
+            int player = turn%NUM_PLAYERS;
+            int num_ranked = rank_actions(&board, player, &options, ranked,
+                &info);
+            if (!num_ranked) {
+                printf(player == BLACK ? WHITE_WIN : BLACK_WIN);
+            } else {
+                print_ranking(ranked, num_ranked, turn, info.depth);
+                if (options.stats) {
+                    node_t best_action;
+                    move_to_action(ranked[0].move, best_action.action);
+                    best_action.cost = ranked[0].cost;
+                    print_search_info(stderr, turn, &best_action, &info,
+                        options.stats);
+                }
+            }
+        }
+
         // command inputted- determine the number of prediction moves to compute
         int comp_actions = 0;
         if (command == A_COMMAND) {
@@ -260,11 +1183,9 @@ int main (int argc, char *argv[]) {
 
         for (int i=0; i<comp_actions; i++) {
             // Find the best action for the current board
-            node_t *best_action = create_new_node(TEMP); 
-                    // starts with a temporary placeholder action
-            best_action = minimax(ROOT_DEPTH, TREE_DEPTH, board, 
-                turn%NUM_PLAYERS, best_action);
-                    // that is then be replaced by the best action from minimax
+            search_info_t info;
+            node_t *best_action = iterative_deepening(&board,
+                turn%NUM_PLAYERS, &options, &memory, &info);
             
             // Check if a player won
             if (best_action->cost == INT_MAX) {
@@ -276,42 +1197,48 @@ int main (int argc, char *argv[]) {
             }
 
             // Perform the best action on the board and print it
-            do_action(board, best_action->action, turn%NUM_PLAYERS);
-            print_action(best_action->action, turn, board, TRUE);
+            do_action(&board, best_action->action, turn%NUM_PLAYERS);
+            if (writer) {
+                write_ply(writer, action_to_move(best_action->action), &board,
+                    TRUE);
+            }
+            print_action(best_action->action, turn, &board, TRUE,
+                options.output);
+            if (options.stats) {
+                print_search_info(stderr, turn, best_action, &info,
+                    options.stats);
+            }
 
             free(best_action);
             turn++;
         }
+        if (options.output == OUTPUT_SUMMARY) {
+            print_summary(&board, turn);
+        }
     }
-    
+
+    if (writer) {
+        end_game_record(writer, command);
+        if (!close_record_writer(writer)) {
+            perror(options.record);
+        }
+    }
+    if (options.verbose) {
+        search_report(stderr);
+    }
+    egdb_close();
+    book_close();
+    tt_free();
     return EXIT_SUCCESS;            // exit program with the success code
 }
 
 /* ---------------------- Input and Printing Functions ---------------------- */
 /* Fills and prints the initial board setup as specified in Figure 1(a) in the
-    specification sheet.
-*/
-void
-initial_setup(board_t board) {
-    // traverse the board
-    for (int row=0; row<BOARD_SIZE; row++) {
-        for (int col=0; col<BOARD_SIZE; col++){
-            if (col % 2 == ((row + 1) % 2)) {  // checkered cells
-                if (row < ROWS_WITH_PIECES) {
-                    // fill first three rows with white pieces
-                    board[row][col] = CELL_WPIECE;
-                } else if (row >= ROWS_WITH_PIECES + ROWS_WO_PIECES) {
-                    // last three rows with black pieces
-                    board[row][col] = CELL_BPIECE;
-                } else {
-                    // middle two rows with empty pieces
-                    board[row][col] = CELL_EMPTY;
-                }
-            } else {  // non-checkered cells are empty
-                board[row][col] = CELL_EMPTY;
-            }
-        }
-    }
+    specification sheet. The board itself is only printed with full `output`.
+*/
+void
+initial_setup(board_t *board, int output) {
+    fill_initial_board(board);
     
     // find number of black and white pieces
     int num_black = count_type(board, CELL_BPIECE);
@@ -321,95 +1248,344 @@ initial_setup(board_t board) {
     printf("BOARD SIZE: %dx%d\n", BOARD_SIZE, BOARD_SIZE);
     printf("#BLACK PIECES: %d\n", num_black);
     printf("#WHITE PIECES: %d\n", num_white);
-    print_board(board);
+    if (output == OUTPUT_FULL) {
+        print_board(board);
+    }
 }
 
-/* Extracts an action or command from stdin and stores it in action or command.
-    Returns 1 when an action or command is read and 0 if the end of file
-    is reached.
+/* Fills the initial board setup without printing it.
+*/
+void
+fill_initial_board(board_t *board) {
+    // first three rows with white pieces, last three rows with black pieces
+    // and the middle two rows empty (non-checkered cells are always empty)
+    board->pieces[WHITE] = WHITE_START;
+    board->pieces[BLACK] = BLACK_START;
+    board->towers[WHITE] = board->towers[BLACK] = 0;
+    board->empty = EMPTY_START;
+    board->hash = hash_board(board);
+    board->cost = count_cost(board);
+}
+
+/* Prepares `input` to parse `stream`. Interactive input is read a line at a
+    time, anything else in blocks of INPUT_BUFFER_LEN characters.
+*/
+void
+init_input(input_t *input, FILE *stream, int is_interactive) {
+    input->stream = stream;
+    input->is_interactive = is_interactive;
+    input->pos = input->len = 0;
+    input->line = 0;
+}
+
+/* Reads the next block (or line) of the input into its buffer. Returns FALSE
+    if the end of the input is reached.
 */
 int
-get_action(action_t action, char *command) {
-    char ch;
-    int ch_count = 0;
-    while ((ch=getchar()) != EOF) {
+fill_input(input_t *input) {
+    input->pos = 0;
+    if (input->is_interactive) {
+        input->len = fgets(input->buffer, INPUT_BUFFER_LEN, input->stream)
+            ? strlen(input->buffer) : 0;
+    } else {
+        input->len = fread(input->buffer, 1, INPUT_BUFFER_LEN, input->stream);
+    }
+    return input->len > 0;
+}
+
+/* Parses the next non-empty line of `input` and stores it in action or
+    command (dashes and carriage returns are ignored). Returns PARSE_ACTION
+    when an action is read, PARSE_COMMAND when a command is read (in a game
+    file, always the last line), PARSE_END when the input ends and
+    PARSE_ERROR when the line is too short or too long; `input->line` is
+    then the number of that line.
+*/
+int
+get_action(input_t *input, action_t action, char *command) {
+    char text[ACTION_LEN];
+    int len = 0;
+    while (TRUE) {
+        int ch;
+        if (input->pos < input->len) {
+            ch = input->buffer[input->pos++];
+        } else if (fill_input(input)) {
+            continue;
+        } else if (len) {
+            ch = NEWLINE_CHAR;  // the last line has no newline
+        } else {
+            return PARSE_END;   // end of file reached
+        }
+
         if (ch == NEWLINE_CHAR) {  // end of action or command
-            if (ch_count == ACTION_LEN) {
+            input->line++;
+            if (len == ACTION_LEN) {
+                memcpy(action, text, ACTION_LEN);
                 action[ACTION_LEN] = '\0';
-                return 1;
-            } else if (ch_count == COMMAND_LEN) {
-                *command = action[0];
-                return 1;
+                return PARSE_ACTION;
+            } else if (len == COMMAND_LEN) {
+                *command = text[0];
+                return PARSE_COMMAND;
+            } else if (len) {
+                return PARSE_ERROR;
             }
-            ch_count = 0;
-        } else if (ch == DASH) {  // ignore dashes
-            continue;
+        } else if (ch != DASH && ch != CARRIAGE_RETURN) {
+            if (len < ACTION_LEN) {
+                text[len] = ch;  // fill in the action string
+            }
+            if (len <= ACTION_LEN) {
+                len++;  // stop counting once the line is too long
+            }
+        }
+    }
+}
+
+/* Reads the command line options into `options`. Returns FALSE if an option is
+    not recognised.
+*/
+int
+read_options(int argc, char *argv[], options_t *options) {
+    options->hash_mb = HASH_MB;
+    options->verbose = FALSE;
+    options->depth = 0;
+    options->time_ms = 0;
+    options->max_nodes = 0;
+    options->threads = 1;
+    options->output = OUTPUT_FULL;
+    options->stats = STATS_NONE;
+    options->record = NULL;
+    options->record_flags = 0;
+    options->endgame = NULL;
+    options->book = NULL;
+    options->quiescence = FALSE;
+    options->ponder = FALSE;
+    options->multi_pv = MULTI_PV_ALL;
+    options->stop = NULL;
+    options->command = NULL;
+    options->args = NULL;
+    options->num_args = 0;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], OPT_HASH) == 0 && i+1 < argc) {
+            options->hash_mb = atoi(argv[++i]);
+            if (options->hash_mb < 1) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_VERBOSE) == 0) {
+            options->verbose = TRUE;
+        } else if (strcmp(argv[i], OPT_DEPTH) == 0 && i+1 < argc) {
+            options->depth = atoi(argv[++i]);
+            if (options->depth < 1 || options->depth > MAX_DEPTH) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_TIME) == 0 && i+1 < argc) {
+            options->time_ms = atol(argv[++i]);
+            if (options->time_ms < 1) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_NODES) == 0 && i+1 < argc) {
+            options->max_nodes = strtoull(argv[++i], NULL, 10);
+            if (options->max_nodes < 1) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_THREADS) == 0 && i+1 < argc) {
+            options->threads = atoi(argv[++i]);
+            if (options->threads < 1 || options->threads > MAX_THREADS) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_RECORD) == 0 && i+1 < argc) {
+            options->record = argv[++i];
+        } else if (strcmp(argv[i], OPT_BOOK) == 0 && i+1 < argc) {
+            options->book = argv[++i];
+        } else if (strcmp(argv[i], OPT_ENDGAME) == 0 && i+1 < argc) {
+            options->endgame = argv[++i];
+        } else if (strcmp(argv[i], OPT_QUIESCENCE) == 0) {
+            options->quiescence = TRUE;
+        } else if (strcmp(argv[i], OPT_PONDER) == 0) {
+            options->ponder = TRUE;
+        } else if (strcmp(argv[i], OPT_RECORD_EVALS) == 0) {
+            options->record_flags = RECORD_EVALS;
+        } else if (strcmp(argv[i], OPT_OUTPUT) == 0 && i+1 < argc) {
+            static const char *output_names[] = OUTPUT_NAMES;
+            i++;
+            options->output = -1;
+            for (int level=OUTPUT_SUMMARY; level<=OUTPUT_FULL; level++) {
+                if (strcmp(argv[i], output_names[level]) == 0) {
+                    options->output = level;
+                }
+            }
+            if (options->output < 0) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_MULTI_PV) == 0 && i+1 < argc) {
+            options->multi_pv = atoi(argv[++i]);
+            if (options->multi_pv < 1) {
+                return FALSE;
+            }
+        } else if (strcmp(argv[i], OPT_STATS) == 0 && i+1 < argc) {
+            static const char *stats_names[] = STATS_NAMES;
+            i++;
+            options->stats = -1;
+            for (int format=STATS_TEXT; format<=STATS_JSON; format++) {
+                if (strcmp(argv[i], stats_names[format]) == 0) {
+                    options->stats = format;
+                }
+            }
+            if (options->stats < 0) {
+                return FALSE;
+            }
+        } else if (argv[i][0] != DASH) {
+            // the rest of the arguments are a command and its arguments
+            options->command = argv[i];
+            options->args = argv + i + 1;
+            options->num_args = argc - i - 1;
+            break;
         } else {
-            action[ch_count++] = ch;  // fill in the action string
+            return FALSE;
         }
     }
-    return 0;  // end of file reached
+
+    // without a depth, search as deep as the time and node limits allow
+    if (!options->depth) {
+        options->depth = (options->time_ms || options->max_nodes) ?
+            MAX_DEPTH : TREE_DEPTH;
+    }
+    return TRUE;
 }
 
-/* Prints the action information and the checkers board.
+/* Prints the action information and, with full `output`, the checkers board
+    with a single write. Nothing is printed with summary `output`.
 */
 void
-print_action(action_t action, int turn_count, board_t board, int is_computed) {
-    printf(DIVIDER);
-    if (is_computed) printf(COMPUTED_MARKER);
-    if (turn_count%NUM_PLAYERS) {
-        printf("BLACK ACTION #%d: ", turn_count);
-    } else {
-        printf("WHITE ACTION #%d: ", turn_count);
+print_action(action_t action, int turn_count, board_t *board, int is_computed,
+    int output) {
+    if (output == OUTPUT_SUMMARY) {
+        return;
+    }
+    char text[ACTION_TEXT_LEN + BOARD_TEXT_LEN];
+    int len = snprintf(text, ACTION_TEXT_LEN, "%s%s%s ACTION #%d: "
+        "%c%c-%c%c\nBOARD COST: %d\n", DIVIDER,
+        is_computed ? COMPUTED_MARKER : "",
+        turn_count%NUM_PLAYERS ? "BLACK" : "WHITE", turn_count,
+        action[SRC_COL], action[SRC_ROW], action[TAR_COL], action[TAR_ROW],
+        display_cost(board));
+    if (output == OUTPUT_FULL) {
+        len += render_board(board, text + len);
+    }
+    fwrite(text, 1, len, stdout);
+}
+
+/* Prints the actions in `ranked` with an exact cost, best first, with their
+    cost and principal variation, as searched to `depth` for the player to
+    move at `turn_count`. Printed at every output level.
+*/
+void
+print_ranking(ranked_action_t *ranked, int num_ranked, int turn_count,
+    int depth) {
+    printf("%s%s%s RANKING #%d (DEPTH %d):\n", DIVIDER, COMPUTED_MARKER,
+        turn_count%NUM_PLAYERS ? "BLACK" : "WHITE", turn_count, depth);
+    for (int i=0; i<num_ranked && ranked[i].is_exact; i++) {
+        printf("%d. COST: %d, PV:", i+1, ranked[i].cost);
+        for (int j=0; j<ranked[i].pv_len; j++) {
+            action_t action;
+            move_to_action(ranked[i].pv[j], action);
+            printf(" %c%c-%c%c", action[SRC_COL], action[SRC_ROW],
+                action[TAR_COL], action[TAR_ROW]);
+        }
+        printf("\n");
     }
-    printf("%c%c-%c%c\n", action[SRC_COL], action[SRC_ROW], action[TAR_COL],
-        action[TAR_ROW]);
-    printf("BOARD COST: %d\n", calculate_cost(board));
-    print_board(board);
+}
+
+/* Prints the number of actions so far, the cost and the board, for the
+    summary output level.
+*/
+void
+print_summary(board_t *board, int turn_count) {
+    char text[ACTION_TEXT_LEN + BOARD_TEXT_LEN];
+    int len = snprintf(text, ACTION_TEXT_LEN, "%sACTIONS: %d\n"
+        "BOARD COST: %d\n", DIVIDER, turn_count - 1, display_cost(board));
+    len += render_board(board, text + len);
+    fwrite(text, 1, len, stdout);
 }
 
 /* ------------------- Input and Printing Helper Functions ------------------ */
 
-/* Prints the `board` using stdout.
+/* Prints the `board` using stdout with a single write.
 */
 void
-print_board(board_t board) {
-    printf(COL_DISPLAY);
-    printf(ROW_DIVIDER);
-    for (int i=0; i<BOARD_SIZE; i++) {  // traverse the rows
-        printf(" %d ", i+1);  // print row number
+print_board(board_t *board) {
+    char text[BOARD_TEXT_LEN];
+    fwrite(text, 1, render_board(board, text), stdout);
+}
 
-        for (int j=0; j<BOARD_SIZE; j++){  // traverse the columns
-            printf(CELL_DIVIDER);
-            printf(" %c ", board[i][j]);  // display cell value
+/* Writes the text of the `board` into `text`, which must hold at least
+    BOARD_TEXT_LEN characters. Returns the length of the text.
+*/
+int
+render_board(board_t *board, char *text) {
+    char *pos = text;
+    memcpy(pos, COL_DISPLAY, sizeof(COL_DISPLAY) - 1);
+    pos += sizeof(COL_DISPLAY) - 1;
+    memcpy(pos, ROW_DIVIDER, sizeof(ROW_DIVIDER) - 1);
+    pos += sizeof(ROW_DIVIDER) - 1;
+    for (int i=0; i<BOARD_SIZE; i++) {  // traverse the rows
+        *pos++ = ' ';   // row number
+        *pos++ = '1' + i;
+        *pos++ = ' ';
+        for (int j=0; j<BOARD_SIZE; j++) {  // traverse the columns
+            *pos++ = CELL_DIVIDER[0];
+            *pos++ = ' ';
+            *pos++ = get_cell(board, i, j);  // display cell value
+            *pos++ = ' ';
         }
-        printf(CELL_DIVIDER);
-        printf(NEWLINE);
-        printf(ROW_DIVIDER);
+        *pos++ = CELL_DIVIDER[0];
+        *pos++ = NEWLINE_CHAR;
+        memcpy(pos, ROW_DIVIDER, sizeof(ROW_DIVIDER) - 1);
+        pos += sizeof(ROW_DIVIDER) - 1;
+    }
+    return pos - text;
+}
+
+/* Returns the cost printed for the `board`: like calculate_cost, except that
+    a player without pieces has lost, which is shown as INT_MIN or INT_MAX.
+*/
+int
+display_cost(board_t *board) {
+    if (!(board->pieces[BLACK] | board->towers[BLACK])) {
+        return INT_MIN;
+    } else if (!(board->pieces[WHITE] | board->towers[WHITE])) {
+        return INT_MAX;
     }
+    return calculate_cost(board);
 }
 
 /* Counts and returns the number of pieces or towers of `type` on the board.
     `type` can be CELL_BPIECE, CELL_WPIECE, CELL_BTOWER or CELL_WTOWER.
 */
 int
-count_type(board_t board, char type) {
-    int num = 0;
-    // traverse through the board
-    for (int i=0; i<BOARD_SIZE; i++){
-        for (int j=0; j<BOARD_SIZE; j++){
-            if (board[i][j] == type){  // check if the cell value is of `type`
-                num ++;
-            }
-        }
+count_type(board_t *board, char type) {
+    switch (type) {
+        case CELL_BPIECE: return count_bits(board->pieces[BLACK]);
+        case CELL_WPIECE: return count_bits(board->pieces[WHITE]);
+        case CELL_BTOWER: return count_bits(board->towers[BLACK]);
+        case CELL_WTOWER: return count_bits(board->towers[WHITE]);
     }
-    return num;
+    return 0;
+}
+
+/* Returns the cost of the board. The cost is kept up to date by make_move and
+    unmake_move, so it does not need to be counted again.
+*/
+int
+calculate_cost(board_t *board) {
+#ifdef DEBUG
+    assert(board->cost == count_cost(board));
+#endif
+    return board->cost;
 }
 
-/* Calculates and returns the cost of the board.
+/* Counts the pieces and towers on the board to calculate its cost.
 */
 int
-calculate_cost(board_t board) {
+count_cost(board_t *board) {
     int cost = COST_PIECE * count_type(board, CELL_BPIECE)
              - COST_PIECE * count_type(board, CELL_WPIECE)
              + COST_TOWER * count_type(board, CELL_BTOWER)
@@ -424,7 +1600,7 @@ calculate_cost(board_t board) {
     is TRUE.
 */
 int
-is_action_legal(board_t board, action_t action, int player, int is_printing) {
+is_action_legal(board_t *board, action_t action, int player, int is_printing) {
     // (1) source cell is within the board's range
     if (!(action[SRC_COL] >= 'A' && action[SRC_COL] <= 'H') 
         || !(action[SRC_ROW] >= '1' && action[SRC_ROW] <= '8')) {
@@ -439,8 +1615,10 @@ is_action_legal(board_t board, action_t action, int player, int is_printing) {
         return FALSE;
     }
 
-    char src = board[action[SRC_ROW]+ROW_OFFSET][action[SRC_COL]+COL_OFFSET];
-    char tar = board[action[TAR_ROW]+ROW_OFFSET][action[TAR_COL]+COL_OFFSET];
+    char src = get_cell(board, action[SRC_ROW]+ROW_OFFSET,
+        action[SRC_COL]+COL_OFFSET);
+    char tar = get_cell(board, action[TAR_ROW]+ROW_OFFSET,
+        action[TAR_COL]+COL_OFFSET);
 
     // (3) source cell is empty
     if (src == CELL_EMPTY) {
@@ -461,264 +1639,4083 @@ is_action_legal(board_t board, action_t action, int player, int is_printing) {
         return FALSE;
     }
 
-    // (6a) pieces moving backward
-    int row_diff = action[TAR_ROW] - action[SRC_ROW];
-
-    if ((row_diff > 0 && src == CELL_BPIECE)        // black piece moving south
-        || (row_diff < 0 && src == CELL_WPIECE)) { // white piece moving north
-        if (is_printing) printf(ERROR6);
-        // printf("moving backward\n"); // DEBUG
-        return FALSE;
-    }
-
-    // (6b) piece/tower is not moving diagonally, moving too many steps or
-    //      is not moving
-    int col_diff = action[TAR_COL] - action[SRC_COL];
-
-    if ((abs(row_diff) != abs(col_diff))        
-        || (abs(row_diff) > CAP_STEP)           // too many steps
-        || (abs(row_diff) < MOVE_STEP)) {       // too few steps
-        if (is_printing) printf(ERROR6);
-        return FALSE;
-    }
-
-    // (6c) check if the captured cell holds opponent's piece/tower
-    if (abs(row_diff) == CAP_STEP) {    // action is a capture
-        int cap_col = action[SRC_COL] + col_diff/2 + COL_OFFSET;
-        int cap_row = action[SRC_ROW] + row_diff/2 + ROW_OFFSET;
-        char cap = board[cap_row][cap_col];
-        if (!((player == BLACK && (cap == CELL_WPIECE || cap == CELL_WTOWER))
-            || (player == WHITE && (cap == CELL_BPIECE || cap == CELL_BTOWER))
-        )) {
-            if (is_printing) printf(ERROR6);
-            return FALSE;
+    // (6) the target is one step away in a direction the piece/tower moves
+    //     in (pieces only move forward), or two steps away over an
+    //     opponent's piece/tower
+    move_t move = action_to_move(action);
+    int src_sq = MOVE_SRC(move), tar_sq = MOVE_TAR(move);
+    int is_tower = (src == CELL_BTOWER || src == CELL_WTOWER);
+    bitboard_t opp = board->pieces[!player] | board->towers[!player];
+    int is_checkered = (action[TAR_COL]+COL_OFFSET) % 2
+        == (action[TAR_ROW]+ROW_OFFSET+1) % 2;
+    for (int dir=0; dir<NUM_DIRS && is_checkered; dir++) {
+        if (!is_tower && !IS_FORWARD[player][dir]) {
+            continue;
+        }
+        if (step_squares[src_sq][dir] == tar_sq
+            || (jump_squares[src_sq][dir] == tar_sq
+                && (opp & SQUARE_BIT(jumped_squares[src_sq][dir])))) {
+            return TRUE;
         }
     }
-
-    return TRUE;
+    if (is_printing) printf(ERROR6);
+    return FALSE;
 }
 
 /* Performs the action onto the board.
 */
 void
-do_action(board_t board, action_t action, int player) {
-    // Update the target cell
-    if (action[TAR_ROW] == B_TOW_ROW || action[TAR_ROW] == W_TOW_ROW) {
-        // piece turning into a tower
-        if (player == BLACK) {
-            board[action[TAR_ROW]+ROW_OFFSET][action[TAR_COL]+COL_OFFSET] =
-                CELL_BTOWER;
-        } else {
-            board[action[TAR_ROW]+ROW_OFFSET][action[TAR_COL]+COL_OFFSET] =
-                CELL_WTOWER;
-        }
-    } else {
-        board[action[TAR_ROW]+ROW_OFFSET][action[TAR_COL]+COL_OFFSET] = 
-            board[action[SRC_ROW]+ROW_OFFSET][action[SRC_COL]+COL_OFFSET];
-    }
+do_action(board_t *board, action_t action, int player) {
+    undo_t undo;
+    make_move(board, action_to_move(action), player, &undo);
+}
 
-    // Update the source cell
-    board[action[SRC_ROW]+ROW_OFFSET][action[SRC_COL]+COL_OFFSET] = CELL_EMPTY;
+/* Performs the move onto the board, and fills `undo` with what unmake_move
+    needs to take it back: the captured piece, whether the piece turned into
+    a tower and the previous hash.
+*/
+SPECIALIZED void
+make_move(board_t *board, move_t move, int player, undo_t *undo) {
+    int src = MOVE_SRC(move), tar = MOVE_TAR(move);
+    int tar_row = SQUARE_ROW(tar);
+    undo->hash = board->hash;
+    undo->captured = NO_PIECE;
+    undo->promoted = FALSE;
 
-    // Update captured cell
-    int row_diff = action[TAR_ROW] - action[SRC_ROW];
-    if (abs(row_diff) == CAP_STEP) {  // check if the action is a capture
-        int col_diff = action[TAR_COL] - action[SRC_COL];
-        int cap_col = action[SRC_COL] + col_diff/2 + COL_OFFSET;
-        int cap_row = action[SRC_ROW]+ row_diff/2 + ROW_OFFSET;
+    // Update the source and target cells
+    int type = player;
+    if (board->towers[player] & SQUARE_BIT(src)) {
+        type += NUM_PLAYERS;        // a tower moving
+    } else if (tar_row == TOWER_ROW[player]) {
+        undo->promoted = TRUE;      // piece turning into a tower
+    }
+    int tar_type = undo->promoted ? type + NUM_PLAYERS : type;
+    *type_cells(board, type) &= ~SQUARE_BIT(src);
+    *type_cells(board, tar_type) |= SQUARE_BIT(tar);
+    board->empty ^= SQUARE_BIT(src) | SQUARE_BIT(tar);
+    board->hash ^= zobrist_cells[type][src] ^ zobrist_cells[tar_type][tar]
+        ^ zobrist_side;
+    board->cost += TYPE_COST[tar_type] - TYPE_COST[type];
 
-        board[cap_row][cap_col] = CELL_EMPTY;
+    // Update captured cell
+    int cap = move_captures[move];
+    if (cap != NO_SQUARE) {     // the move is a capture
+        for (int cap_type=0; cap_type<NUM_PIECE_TYPES; cap_type++) {
+            bitboard_t *cells = type_cells(board, cap_type);
+            if (*cells & SQUARE_BIT(cap)) {
+                *cells &= ~SQUARE_BIT(cap);
+                board->hash ^= zobrist_cells[cap_type][cap];
+                board->cost -= TYPE_COST[cap_type];
+                undo->captured = cap_type;
+            }
+        }
+        board->empty |= SQUARE_BIT(cap);
     }
 }
 
-/* ---------------------------- Minimax Function ---------------------------- */
-
-/* Recursive function that applies the minimax algorithm till a specific `depth`
-    to the current `board` and returns the best action for that board.
+/* Takes back a move performed by make_move, restoring the board exactly.
 */
-node_t
-*minimax(int depth, int max_depth, board_t board, int player, node_t *node) {
-    // Terminate if leaf node is reached
-    if (depth == max_depth) {
-        node->cost = calculate_cost(board);
-        return node;
+SPECIALIZED void
+unmake_move(board_t *board, move_t move, int player, undo_t *undo) {
+    int src = MOVE_SRC(move), tar = MOVE_TAR(move);
+
+    // Restore the source and target cells
+    int tar_type = player;
+    if (board->towers[player] & SQUARE_BIT(tar)) {
+        tar_type += NUM_PLAYERS;
     }
-    
-    // Set different node costs and opponents depending on player
-    int opp;
-    if (player == BLACK) {  // maimising player
-        node->cost = INT_MIN;
-        opp = WHITE;
-    } else {                // minimising player
-        node->cost = INT_MAX;
-        opp = BLACK;
+    int type = undo->promoted ? player : tar_type;
+    *type_cells(board, tar_type) &= ~SQUARE_BIT(tar);
+    *type_cells(board, type) |= SQUARE_BIT(src);
+    board->empty ^= SQUARE_BIT(src) | SQUARE_BIT(tar);
+    board->hash = undo->hash;
+    board->cost -= TYPE_COST[tar_type] - TYPE_COST[type];
+
+    // Restore the captured cell
+    if (undo->captured != NO_PIECE) {
+        int cap = move_captures[move];
+        *type_cells(board, undo->captured) |= SQUARE_BIT(cap);
+        board->empty &= ~SQUARE_BIT(cap);
+        board->cost += TYPE_COST[undo->captured];
     }
+}
 
-    // Get this node's valid actions
-    list_t *valid_actions = make_empty_list();
-    valid_actions = get_valid_actions(board, player, valid_actions);
+/* Returns the cells of piece type `type` (player, plus NUM_PLAYERS for towers).
+*/
+bitboard_t
+*type_cells(board_t *board, int type) {
+    if (type < NUM_PLAYERS) {
+        return &board->pieces[type];
+    }
+    return &board->towers[type - NUM_PLAYERS];
+}
 
-    // Traverse through list of valid actions
-    node_t *curr = valid_actions->head;
-    while (curr) {
-        // make a copy of the board
-        board_t board_copy;
-        copy_board(board, board_copy);
+/* --------------------------- Bitboard Functions --------------------------- */
 
-        // perform the current action onto the copy
-        do_action(board_copy, curr->action, player);
+/* Returns the cell character at `row` and `col` of the board.
+*/
+char
+get_cell(board_t *board, int row, int col) {
+    if (col % 2 != ((row + 1) % 2)) {  // non-checkered cells are empty
+        return CELL_EMPTY;
+    }
+    bitboard_t bit = SQUARE_BIT(cell_to_square(row, col));
+    if (board->pieces[BLACK] & bit) return CELL_BPIECE;
+    if (board->pieces[WHITE] & bit) return CELL_WPIECE;
+    if (board->towers[BLACK] & bit) return CELL_BTOWER;
+    if (board->towers[WHITE] & bit) return CELL_WTOWER;
+    return CELL_EMPTY;
+}
 
-        // recursive call find the cost of the leaf node
-        node_t *child_node = minimax(depth+1, max_depth, board_copy, opp, curr);
+/* Converts a checkered cell's grid index values to its bitboard square.
+*/
+int
+cell_to_square(int row, int col) {
+    return row*SQUARES_PER_ROW + col/2;
+}
 
-        // compare the leaf cost with the best cost
-        if ((player == BLACK && (child_node->cost > node->cost))
-            || (player == WHITE && (child_node->cost < node->cost))) {
-            if (depth == ROOT_DEPTH) {
-                // replace root action value with the best action
-                strcpy(node->action, child_node->action);
-            }
-            // pass the child node cost up to the parent node
-            node->cost = child_node->cost;
-        }
-        curr = curr->next;
-    }
-    free(curr);
-    free_list(valid_actions);
-    return node;
+/* Converts a bitboard square into its column and row characters.
+*/
+void
+square_to_cell(int sq, char *col, char *row) {
+    *row = SQUARE_ROW(sq) - ROW_OFFSET;
+    *col = SQUARE_COL(sq) - COL_OFFSET;
 }
 
-/* ------------------------ Minimax Helper Functions ------------------------ */
-/* Find valid moves for the board for the current player and inserts them into
-    a linked list.
-*/
-list_t
-*get_valid_actions(board_t board, int player, list_t *valid_actions) {
-    // Traversing the board in row-major order
-    for (int row=0; row<BOARD_SIZE; row++) {
-        for (int col=0; col<BOARD_SIZE; col++) {
-            char cell = board[row][col];
-            // Finding for cells containing the player's pieces
-            if ((player == BLACK && (cell == CELL_BPIECE || 
-                                                        cell == CELL_BTOWER))
-                || (player == WHITE && (cell == CELL_WPIECE ||
-                                                        cell == CELL_WTOWER))
-            ) {
-                // Check north-east actions
-                get_valid_action_in_dir(col, row, NORTH, EAST, player, board,
-                    valid_actions);
-                // Check south-east actions
-                get_valid_action_in_dir(col, row, SOUTH, EAST, player, board,
-                    valid_actions);
-                // Check south-west actions
-                get_valid_action_in_dir(col, row, SOUTH, WEST, player, board,
-                    valid_actions);
-                // Check north-west actions
-                get_valid_action_in_dir(col, row, NORTH, WEST, player, board,
-                    valid_actions);
-            }
-        }
-    }
-    return valid_actions;
-}
-
-/* Adds valid actions in a certain direction for a specific piece into 
-    `valid_actions`.
-*/
-list_t
-*get_valid_action_in_dir(int col, int row, int row_diff, int col_diff, 
-    int player, board_t board, list_t *valid_actions) {
-    // Create an action in this direction
-    action_t action;
-    action[SRC_COL] = col - COL_OFFSET;
-    action[SRC_ROW] = row - ROW_OFFSET;
-    action[TAR_COL] = action[SRC_COL] + col_diff;
-    action[TAR_ROW] = action[SRC_ROW] + row_diff;
-    action[ACTION_LEN] = '\0';
-    
-    // Check if the action is legal
-    if (is_action_legal(board, action, player, FALSE)) {    // legal action
-        // ddd it to the linked list
-        node_t *action_node = create_new_node(action);
-        valid_actions = insert_at_foot(valid_actions, action_node);
-    } else if (abs(row_diff) == 1) {                             // illegal move
-        // now check for capture in direction
-        get_valid_action_in_dir(col, row, CAP_STEP*row_diff, CAP_STEP*col_diff,
-            player, board, valid_actions);
-    }
-    
-    return valid_actions;
+/* Returns the cells that reach one of `cells` with a one step move in `dir`.
+*/
+bitboard_t
+step_back(bitboard_t cells, int dir) {
+    return STEP_MASK[dir] & ((EVEN_ROWS & SHIFT(cells, -STEP_EVEN[dir]))
+                           | (ODD_ROWS & SHIFT(cells, -STEP_ODD[dir])));
 }
 
-/* Copies all values from `board` to `board_copy`.
+/* Fills in the squares reached with a one step move and a capture from every
+    square in every direction, the squares captures jump over and the square
+    every move captures on, so moves are made and generated with lookups.
 */
 void
-copy_board(board_t board, board_t board_copy) {
-    for (int i=0; i<BOARD_SIZE; i++) {
-        for (int j=0; j<BOARD_SIZE; j++) {
-            board_copy[i][j] = board[i][j];
+init_move_tables(void) {
+    memset(move_captures, NO_SQUARE, sizeof(move_captures));
+    for (int sq=0; sq<NUM_SQUARES; sq++) {
+        int row = SQUARE_ROW(sq), col = SQUARE_COL(sq);
+        for (int dir=0; dir<NUM_DIRS; dir++) {
+            int step = square_at(row + MOVE_STEP*DIR_ROWS[dir],
+                col + MOVE_STEP*DIR_COLS[dir]);
+            int jump = square_at(row + CAP_STEP*DIR_ROWS[dir],
+                col + CAP_STEP*DIR_COLS[dir]);
+            step_squares[sq][dir] = step;
+            jump_squares[sq][dir] = jump;
+            jumped_squares[sq][dir] = jump == NO_SQUARE ? NO_SQUARE : step;
+            if (jump != NO_SQUARE) {
+                move_captures[ENCODE_MOVE(sq, jump)] = step;
+            }
         }
     }
 }
 
-/* -------------------------- Linked List Functions ------------------------- */
-
-/* Creates and returns a new node.
+/* Returns the square of the cell at `row` and `col`, or NO_SQUARE if it is
+    off the board.
 */
-node_t
-*create_new_node(char *action) {
-    node_t* new = (node_t*)malloc(sizeof(node_t));
-    assert(new!=NULL);
-    strcpy(new->action, action);
-    new->next = NULL;
-    return new;
+int
+square_at(int row, int col) {
+    if (row < 0 || row >= BOARD_SIZE || col < 0 || col >= BOARD_SIZE) {
+        return NO_SQUARE;
+    }
+    return cell_to_square(row, col);
 }
 
-/* Create and returns an empty linked list.
-    Adapted version of the make_empty_list function by Alistair Moffat:
-    https://people.eng.unimelb.edu.au/ammoffat/ppsaa/c/listops.c
+/* Counts the number of set bits in `bits`.
 */
-list_t
-*make_empty_list(void) {
-	list_t *list;
-	list = (list_t*)malloc(sizeof(*list));
-	assert(list!=NULL);
-	list->head = list->foot = NULL;
-	return list;
+int
+count_bits(bitboard_t bits) {
+#ifdef __GNUC__
+    return __builtin_popcount(bits);
+#else
+    bits = bits - ((bits >> 1) & 0x55555555U);
+    bits = (bits & 0x33333333U) + ((bits >> 2) & 0x33333333U);
+    return (((bits + (bits >> 4)) & 0x0F0F0F0FU) * 0x01010101U) >> 24;
+#endif
 }
 
-/* Adds an action to the foot-end of `list` and returns the list.
-    Adapted version of the insert_at_foot function by Alistair Moffat:
-    https://people.eng.unimelb.edu.au/ammoffat/ppsaa/c/listops.c
+/* Returns the index of the lowest set bit of `bits` (which is not zero).
 */
-list_t
-*insert_at_foot(list_t *list, node_t *new) {
-    assert(list!=NULL);
-    if (list->foot == NULL) {  // first action in the list
-        list->head = new;
-        list->foot = new;
+int
+first_bit(bitboard_t bits) {
+#ifdef __GNUC__
+    return __builtin_ctz(bits);
+#else
+    int index = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/* --------------------- Transposition Table Functions ---------------------- */
+
+/* Fills the zobrist keys with pseudo-random numbers (splitmix64), always
+    from the same seed so hashes are the same on every run.
+*/
+void
+init_zobrist(void) {
+    uint64_t state = ZOBRIST_SEED;
+    for (int i=0; i<=NUM_PIECE_TYPES*NUM_SQUARES; i++) {
+        uint64_t key = next_random(&state);
+        if (i < NUM_PIECE_TYPES*NUM_SQUARES) {
+            zobrist_cells[i / NUM_SQUARES][i % NUM_SQUARES] = key;
+        } else {
+            zobrist_side = key;
+        }
+    }
+    zobrist_quiescence = next_random(&state);
+}
+
+/* Calculates the zobrist hash of the board from scratch, with black to move.
+    do_action keeps it up to date after that.
+*/
+uint64_t
+hash_board(board_t *board) {
+    uint64_t hash = 0;
+    for (int sq=0; sq<NUM_SQUARES; sq++) {
+        for (int player=0; player<NUM_PLAYERS; player++) {
+            if (board->pieces[player] & SQUARE_BIT(sq)) {
+                hash ^= zobrist_cells[player][sq];
+            }
+            if (board->towers[player] & SQUARE_BIT(sq)) {
+                hash ^= zobrist_cells[player + NUM_PLAYERS][sq];
+            }
+        }
+    }
+    return hash;
+}
+
+/* Allocates a transposition table of the largest power of two number of
+    buckets fitting in `hash_mb` megabytes.
+*/
+void
+tt_init(int hash_mb) {
+    uint64_t bytes = (uint64_t)hash_mb * 1024 * 1024;
+    uint64_t num_buckets = 1;
+    while (2 * num_buckets * BUCKET_SIZE * sizeof(tt_slot_t) <= bytes) {
+        num_buckets *= 2;
+    }
+    memset(&trans_table, 0, sizeof(trans_table));
+    trans_table.buckets = (tt_slot_t*)calloc(num_buckets * BUCKET_SIZE,
+        sizeof(tt_slot_t));
+    assert(trans_table.buckets!=NULL);
+    trans_table.mask = num_buckets - 1;
+}
+
+/* Frees the memory allocated to the transposition table.
+*/
+void
+tt_free(void) {
+    free(trans_table.buckets);
+    trans_table.buckets = NULL;
+}
+
+/* Forgets every stored position.
+*/
+void
+tt_clear(void) {
+    memset(trans_table.buckets, 0,
+        (trans_table.mask + 1) * BUCKET_SIZE * sizeof(tt_slot_t));
+}
+
+/* Starts a new search, so entries of older searches are replaced first.
+*/
+void
+tt_new_search(void) {
+    trans_table.generation++;
+}
+
+/* Looks up the position with hash `key` and copies its entry into `entry`.
+    Returns TRUE if the position is in the table and FALSE otherwise.
+*/
+int
+tt_probe(uint64_t key, tt_entry_t *entry) {
+    tt_slot_t *bucket = trans_table.buckets + (key & trans_table.mask)
+        * BUCKET_SIZE;
+    for (int i=0; i<BUCKET_SIZE; i++) {
+        uint64_t data = atomic_load_explicit(&bucket[i].data,
+            memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket[i].check,
+            memory_order_relaxed);
+        if (data && (check ^ data) == key) {
+            entry->key = key;
+            entry->cost = (int32_t)(uint32_t)data;
+            entry->move = (move_t)(data >> 32);
+            entry->depth = (uint8_t)(data >> 48);
+            entry->flags = (uint8_t)(data >> 56);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Stores the cost of the position with hash `key`. The first entry of a
+    bucket keeps the deepest position of the current search and the second
+    entry is always replaced.
+*/
+void
+tt_store(uint64_t key, int depth, int bound, int cost, move_t move) {
+    tt_slot_t *bucket = trans_table.buckets + (key & trans_table.mask)
+        * BUCKET_SIZE;
+    tt_slot_t *slot = &bucket[BUCKET_SIZE - 1];
+    uint64_t first = atomic_load_explicit(&bucket[0].data,
+        memory_order_relaxed);
+    uint64_t first_key = first ^ atomic_load_explicit(&bucket[0].check,
+        memory_order_relaxed);
+    uint8_t first_depth = (uint8_t)(first >> 48);
+    uint8_t first_generation = (uint8_t)(first >> 56) >> BOUND_BITS;
+    if (first_key == key || depth >= first_depth || first_generation
+        != (trans_table.generation & (UINT8_MAX >> BOUND_BITS))) {
+        slot = &bucket[0];
+    }
+
+    uint8_t flags = bound | (trans_table.generation << BOUND_BITS);
+    uint64_t data = (uint64_t)(uint32_t)cost | (uint64_t)move << 32
+        | (uint64_t)depth << 48 | (uint64_t)flags << 56;
+    atomic_store_explicit(&slot->data, data, memory_order_relaxed);
+    atomic_store_explicit(&slot->check, key ^ data, memory_order_relaxed);
+}
+
+/* Prints the size and hit rate of the transposition table to `stream`.
+*/
+void
+tt_report(FILE *stream) {
+    uint64_t entries = (trans_table.mask + 1) * BUCKET_SIZE;
+    fprintf(stream, "HASH TABLE: %llu entries (%llu KB)\n",
+        (unsigned long long)entries,
+        (unsigned long long)(entries * sizeof(tt_slot_t) / 1024));
+    fprintf(stream, "HASH PROBES: %llu, HITS: %llu (%.1f%%), CUTOFFS: %llu, "
+        "STORES: %llu\n", (unsigned long long)search_stats.tt_probes,
+        (unsigned long long)search_stats.tt_hits,
+        search_stats.tt_probes ?
+            100.0 * search_stats.tt_hits / search_stats.tt_probes : 0.0,
+        (unsigned long long)search_stats.tt_cutoffs,
+        (unsigned long long)search_stats.tt_stores);
+}
+
+/* Converts a compact move into its action.
+*/
+void
+move_to_action(move_t move, action_t action) {
+    square_to_cell(MOVE_SRC(move), &action[SRC_COL], &action[SRC_ROW]);
+    square_to_cell(MOVE_TAR(move), &action[TAR_COL], &action[TAR_ROW]);
+    action[ACTION_LEN] = '\0';
+}
+
+/* Converts an action into its compact move.
+*/
+move_t
+action_to_move(action_t action) {
+    int src = cell_to_square(action[SRC_ROW]+ROW_OFFSET,
+        action[SRC_COL]+COL_OFFSET);
+    int tar = cell_to_square(action[TAR_ROW]+ROW_OFFSET,
+        action[TAR_COL]+COL_OFFSET);
+    return ENCODE_MOVE(src, tar);
+}
+
+/* ---------------------------- Minimax Function ---------------------------- */
+
+/* Searches the board with minimax at increasing depths until `options->depth`
+    is reached or the search runs out of time or nodes. Returns the best action
+    of the deepest completed search (depth 1 is always completed).
+    With more than one thread, helper threads search the same board at the
+    same time (lazy SMP), half of them one depth ahead, and share what they
+    find through the transposition table. Only the main thread's action is
+    used, so the result is the same as with a single thread.
+    The counters and timings of the search are stored in `info` (if not NULL).
+    Boards in the opening book or endgame database (if open) are not
+    searched.
+    With a `memory` of the last search, a board on its principal variation
+    starts from the depth it was already searched to there, and the move
+    ordering tables carry over. Every depth up to `options->depth` is still
+    fully searched, so the action is the same as without it.
+*/
+node_t
+*iterative_deepening(board_t *board, int player, options_t *options,
+    search_memory_t *memory, search_info_t *info) {
+    uint64_t allocations = thread_allocations;
+
+    // boards in the opening book or endgame database are looked up instead
+    move_t db_move;
+    int db_cost;
+    int is_book = opening_book.map
+        && book_probe(board, player, &db_move, &db_cost);
+    if (is_book || (endgame_db.map
+        && egdb_best_move(board, player, &db_move, &db_cost))) {
+        node_t *best_action = create_new_node(TEMP);
+        move_to_action(db_move, best_action->action);
+        best_action->cost = db_cost;
+        search_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.searches = 1;
+        stats.allocations = thread_allocations - allocations;
+        if (is_book) {
+            stats.book_hits = 1;
+        } else {
+            stats.egdb_hits = 1;
+        }
+        if (info) {
+            memset(info, 0, sizeof(search_info_t));
+            info->stats = stats;
+        }
+        pthread_mutex_lock(&search_stats_lock);
+        add_stats(&search_stats, &stats);
+        pthread_mutex_unlock(&search_stats_lock);
+        return best_action;
+    }
+
+    worker_t *workers = (worker_t*)counted_malloc(options->threads
+        * sizeof(worker_t));
+    pthread_t threads[MAX_THREADS];
+    atomic_int abort = FALSE;
+    double start_ms = now_ms();
+    tt_new_search();
+
+    for (int i=0; i<options->threads; i++) {
+        workers[i].id = i;
+        workers[i].board = *board;
+        workers[i].player = player;
+        workers[i].max_depth = options->depth;
+        workers[i].best_move = NO_MOVE;
+        workers[i].best_cost = 0;
+        setup_search(&workers[i].search, options, &abort, start_ms);
+        memset(workers[i].depth_ms, 0, sizeof(workers[i].depth_ms));
+        memset(workers[i].depth_nodes, 0, sizeof(workers[i].depth_nodes));
+
+        // continue from the last search, with its action as the fallback
+        int ply = -1;
+        if (memory) {
+            ply = recall_search(memory, board, &workers[i].search);
+        } else {
+            memset(workers[i].search.killers, 0,
+                sizeof(workers[i].search.killers));
+            memset(workers[i].search.history, 0,
+                sizeof(workers[i].search.history));
+        }
+        if (ply >= 0 && memory->depths[ply] < options->depth) {
+            workers[i].best_move = memory->pv[ply];
+            workers[i].best_cost = memory->costs[ply];
+            workers[i].search.completed = memory->depths[ply];
+            workers[i].search.stats.pv_hits = (i == 0);
+        }
+    }
+    for (int i=1; i<options->threads; i++) {
+        int error = pthread_create(&threads[i], NULL, search_worker,
+            &workers[i]);
+        assert(!error);
+    }
+
+    // search on this thread, then stop the helpers
+    search_worker(&workers[0]);
+    atomic_store(&abort, TRUE);
+    node_t *best_action = create_new_node(TEMP);
+            // starts with a temporary placeholder action
+    search_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    for (int i=0; i<options->threads; i++) {
+        if (i) {
+            pthread_join(threads[i], NULL);
+        }
+        add_stats(&stats, &workers[i].search.stats);
+    }
+    // with this thread's allocations outside its search_worker call
+    stats.allocations += thread_allocations - allocations
+        - workers[0].search.stats.allocations;
+    stats.searches = 1;
+    pthread_mutex_lock(&search_stats_lock);
+    add_stats(&search_stats, &stats);
+    pthread_mutex_unlock(&search_stats_lock);
+    if (info) {
+        info->depth = workers[0].search.completed;
+        info->time_ms = now_ms() - start_ms;
+        memcpy(info->depth_ms, workers[0].depth_ms, sizeof(info->depth_ms));
+        memcpy(info->depth_nodes, workers[0].depth_nodes,
+            sizeof(info->depth_nodes));
+        info->stats = stats;
+    }
+
+    if (workers[0].best_move != NO_MOVE) {
+        // that is then be replaced by the best action from minimax
+        move_to_action(workers[0].best_move, best_action->action);
+    }
+    best_action->cost = workers[0].best_cost;
+    if (memory) {
+        remember_search(memory, board, &workers[0]);
+    }
+    free(workers);
+    return best_action;
+}
+
+/* Runs the iterative deepening search of one thread.
+*/
+void
+*search_worker(void *arg) {
+    worker_t *worker = (worker_t*)arg;
+    search_t *search = &worker->search;
+    int offset = worker->id % 2;    // odd helpers search one depth ahead
+    uint64_t allocations = thread_allocations;
+
+    // depths already searched by the last search are skipped
+    for (int depth=search->completed+1; depth<=worker->max_depth; depth++) {
+        int max_depth = depth + offset;
+        if (max_depth > worker->max_depth) {
+            max_depth = worker->max_depth;
+        }
+        int cost = minimax(search, ROOT_DEPTH, max_depth, &worker->board,
+            worker->player, INT_MIN, INT_MAX);
+        if (search->stopped) {  // unfinished search, use the previous one
+            break;
+        }
+        worker->best_move = search->root_move;
+        worker->best_cost = cost;
+        worker->depth_ms[depth] = now_ms() - search->start_ms;
+        worker->depth_nodes[depth] = search->stats.nodes;
+        search->completed = depth;
+    }
+    search->stats.allocations += thread_allocations - allocations;
+    return NULL;
+}
+
+/* Sets up `search` to start with the limits of `options`, counting time from
+    `start_ms`. Its move ordering tables are left as they are.
+*/
+void
+setup_search(search_t *search, options_t *options, atomic_int *abort,
+    double start_ms) {
+    search->time_ms = options->time_ms;
+    search->max_nodes = options->max_nodes;
+    search->start_ms = start_ms;
+    search->abort = abort;
+    search->completed = 0;
+    search->stopped = FALSE;
+    search->quiescence = options->quiescence;
+    search->variant = options->quiescence ? zobrist_quiescence : 0;
+    search->stop = options->stop;
+    memset(&search->stats, 0, sizeof(search_stats_t));
+}
+
+/* Ranks the valid actions of `player` on the `board` by their cost, searched
+    at increasing depths like iterative_deepening, and stores them in `ranked`
+    with the best first. Returns the number of valid actions.
+    Only the best `options->multi_pv` actions (all of them with MULTI_PV_ALL)
+    get an exact cost and principal variation. Every depth searches the
+    actions in the order of the last one, and once that many actions have an
+    exact cost, the others are only checked against the worst of them with a
+    window that proves they are not better, which costs much less than
+    searching the board once for each of the best actions. Ties go to the
+    action generated first, as in minimax, so the best action is the one the
+    A command plays. The search runs on one thread, and is not continued from
+    or stored in a search memory.
+*/
+int
+rank_actions(board_t *board, int player, options_t *options,
+    ranked_action_t *ranked, search_info_t *info) {
+    uint64_t allocations = thread_allocations;
+    search_t *search = (search_t*)counted_malloc(sizeof(search_t));
+    atomic_int abort = FALSE;
+    double start_ms = now_ms();
+    tt_new_search();
+    setup_search(search, options, &abort, start_ms);
+    memset(search->killers, 0, sizeof(search->killers));
+    memset(search->history, 0, sizeof(search->history));
+    if (info) {
+        memset(info, 0, sizeof(search_info_t));
+    }
+
+    // start from the generated order
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(board, player, moves);
+    for (int i=0; i<num_moves; i++) {
+        ranked[i].move = moves[i];
+        ranked[i].cost = 0;
+        ranked[i].is_exact = FALSE;
+        ranked[i].index = i;
+        ranked[i].pv_len = 0;
+    }
+    int multi_pv = options->multi_pv;
+    if (multi_pv == MULTI_PV_ALL || multi_pv > num_moves) {
+        multi_pv = num_moves;
+    }
+
+    ranked_action_t depth_ranked[MAX_MOVES];
+    for (int depth=1; depth<=options->depth && num_moves; depth++) {
+        int num_exact = 0;
+        for (int i=0; i<num_moves; i++) {
+            // once enough actions are exact, only check whether this one
+            // ranks before the worst of them (as good is enough if it wins
+            // ties) with a null window, and find its exact cost if it does
+            ranked_action_t action = ranked[i];
+            ranked_action_t *worst = num_exact >= multi_pv ?
+                &depth_ranked[multi_pv-1] : NULL;
+            int wins_tie = worst && action.index < worst->index;
+            int alpha = INT_MIN, beta = INT_MAX;
+            if (worst && player == BLACK) {
+                alpha = (wins_tie && worst->cost > INT_MIN) ?
+                    worst->cost - 1 : worst->cost;
+            } else if (worst && player == WHITE) {
+                beta = (wins_tie && worst->cost < INT_MAX) ?
+                    worst->cost + 1 : worst->cost;
+            }
+            undo_t undo;
+            make_move(board, action.move, player, &undo);
+            if ((player == BLACK && alpha == INT_MAX)
+                || (player == WHITE && beta == INT_MIN)) {
+                // the worst of them already has the best possible cost
+                action.cost = player == BLACK ? INT_MAX : INT_MIN;
+                action.is_exact = FALSE;
+            } else if (alpha == INT_MIN && beta == INT_MAX) {
+                // nothing to rank against, or nothing can rank after it
+                action.cost = minimax(search, ROOT_DEPTH+1, depth, board,
+                    !player, alpha, beta);
+                action.is_exact = TRUE;
+            } else if (player == BLACK) {
+                action.cost = minimax(search, ROOT_DEPTH+1, depth, board,
+                    !player, alpha, alpha+1);
+                action.is_exact = action.cost > alpha;
+                if (action.is_exact && action.cost < INT_MAX) {
+                    action.cost = minimax(search, ROOT_DEPTH+1, depth, board,
+                        !player, alpha, INT_MAX);
+                }
+            } else {
+                action.cost = minimax(search, ROOT_DEPTH+1, depth, board,
+                    !player, beta-1, beta);
+                action.is_exact = action.cost < beta;
+                if (action.is_exact && action.cost > INT_MIN) {
+                    action.cost = minimax(search, ROOT_DEPTH+1, depth, board,
+                        !player, INT_MIN, beta);
+                }
+            }
+            action.pv_len = 0;
+            if (!search->stopped && action.is_exact) {
+                // follow the exact costs of the transposition table
+                board_t line = *board;
+                int line_player = !player, line_cost;
+                move_t move = action.move;
+                while (move != NO_MOVE) {
+                    action.pv[action.pv_len++] = move;
+                    move = pv_move(&line, line_player,
+                        depth - action.pv_len, search->variant, &line_cost);
+                    if (move != NO_MOVE) {
+                        undo_t line_undo;
+                        make_move(&line, move, line_player, &line_undo);
+                        line_player = !line_player;
+                    }
+                }
+            }
+            unmake_move(board, action.move, player, &undo);
+            if (search->stopped) {
+                break;
+            }
+
+            // insert it among the actions searched so far
+            int j = i;
+            while (j > 0 && is_ranked_before(&action, &depth_ranked[j-1],
+                player)) {
+                depth_ranked[j] = depth_ranked[j-1];
+                j--;
+            }
+            depth_ranked[j] = action;
+            num_exact += action.is_exact;
+        }
+        if (search->stopped) {  // unfinished depth, keep the last one
+            break;
+        }
+        memcpy(ranked, depth_ranked, num_moves * sizeof(ranked_action_t));
+        search->completed = depth;
+        if (info) {
+            info->depth_ms[depth] = now_ms() - start_ms;
+            info->depth_nodes[depth] = search->stats.nodes;
+        }
+    }
+
+    search->stats.searches = 1;
+    search->stats.allocations = thread_allocations - allocations;
+    pthread_mutex_lock(&search_stats_lock);
+    add_stats(&search_stats, &search->stats);
+    pthread_mutex_unlock(&search_stats_lock);
+    if (info) {
+        info->depth = search->completed;
+        info->time_ms = now_ms() - start_ms;
+        info->stats = search->stats;
+    }
+    free(search);
+    return num_moves;
+}
+
+/* Returns TRUE if the ranked action `a` goes before `b` for `player`: it has
+    an exact cost and `b` does not, or a better cost, or the same cost and it
+    was generated first.
+*/
+int
+is_ranked_before(ranked_action_t *a, ranked_action_t *b, int player) {
+    if (a->is_exact != b->is_exact) {
+        return a->is_exact;
+    }
+    if (a->cost != b->cost) {
+        return (player == BLACK) ? a->cost > b->cost : a->cost < b->cost;
+    }
+    return a->index < b->index;
+}
+
+/* Returns the action of `player` stored in the transposition table (under
+    keys xor'ed with `variant`) for the `board` with its exact cost searched
+    to `depth`, and sets `cost` to it. Returns NO_MOVE if there is none, or if
+    it is not valid on the board (a collision of keys).
+*/
+move_t
+pv_move(board_t *board, int player, int depth, uint64_t variant, int *cost) {
+    tt_entry_t entry;
+    if (depth <= 0 || !tt_probe(board->hash ^ variant, &entry)
+        || entry.depth != depth
+        || (entry.flags & ((1 << BOUND_BITS) - 1)) != BOUND_EXACT) {
+        return NO_MOVE;
+    }
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(board, player, moves);
+    for (int i=0; i<num_moves; i++) {
+        if (moves[i] == entry.move) {
+            *cost = entry.cost;
+            return entry.move;
+        }
+    }
+    return NO_MOVE;
+}
+
+/* Stores the principal variation and move ordering tables of the search of
+    `worker` from the `board` in `memory`. The variation follows the exact
+    costs in the transposition table from the best action of the root.
+*/
+void
+remember_search(search_memory_t *memory, board_t *board, worker_t *worker) {
+    search_t *search = &worker->search;
+    memcpy(memory->killers, search->killers, sizeof(memory->killers));
+    memcpy(memory->history, search->history, sizeof(memory->history));
+    memory->pv_len = 0;
+    board_t line = *board;
+    int player = worker->player;
+    move_t move = worker->best_move;
+    int cost = worker->best_cost;
+    int depth = search->completed;
+    while (move != NO_MOVE && depth > 0) {
+        memory->hashes[memory->pv_len] = line.hash;
+        memory->pv[memory->pv_len] = move;
+        memory->costs[memory->pv_len] = cost;
+        memory->depths[memory->pv_len] = depth;
+        memory->pv_len++;
+        undo_t undo;
+        make_move(&line, move, player, &undo);
+        player = !player;
+        depth--;
+
+        // the next action must be stored with its exact cost and depth
+        move = pv_move(&line, player, depth, search->variant, &cost);
+    }
+}
+
+/* Sets up the move ordering tables of `search` from the last search in
+    `memory`: its history scores count half, and if the `board` is on its
+    principal variation its killer actions move up by the actions played
+    since. Returns the ply of the board on the principal variation, or -1 if
+    it is not on it.
+*/
+int
+recall_search(search_memory_t *memory, board_t *board, search_t *search) {
+    for (int player=0; player<NUM_PLAYERS; player++) {
+        for (int i=0; i<NUM_SQUARES*NUM_SQUARES; i++) {
+            search->history[player][i] = memory->history[player][i] / 2;
+        }
+    }
+    memset(search->killers, 0, sizeof(search->killers));
+    for (int ply=0; ply<memory->pv_len; ply++) {
+        if (memory->hashes[ply] == board->hash) {
+            memcpy(search->killers, memory->killers[ply],
+                (MAX_PLY - ply) * sizeof(search->killers[0]));
+            return ply;
+        }
+    }
+    return -1;
+}
+
+/* Adds the counters in `stats` to `total`.
+*/
+void
+add_stats(search_stats_t *total, search_stats_t *stats) {
+    total->nodes += stats->nodes;
+    total->tt_probes += stats->tt_probes;
+    total->tt_hits += stats->tt_hits;
+    total->tt_cutoffs += stats->tt_cutoffs;
+    total->tt_stores += stats->tt_stores;
+    total->searches += stats->searches;
+    total->allocations += stats->allocations;
+    total->cutoffs += stats->cutoffs;
+    total->first_cutoffs += stats->first_cutoffs;
+    total->egdb_hits += stats->egdb_hits;
+    total->book_hits += stats->book_hits;
+    total->qnodes += stats->qnodes;
+    total->pv_hits += stats->pv_hits;
+    total->ponders += stats->ponders;
+    total->ponder_hits += stats->ponder_hits;
+}
+
+/* Prints the counters of every search so far to `stream`.
+*/
+void
+search_report(FILE *stream) {
+    uint64_t searches = search_stats.searches;
+    fprintf(stream, "SEARCHES: %llu, NODES: %llu, ALLOCATIONS PER SEARCH: "
+        "%.1f\n", (unsigned long long)searches,
+        (unsigned long long)search_stats.nodes,
+        searches ? (double)search_stats.allocations / searches : 0.0);
+    fprintf(stream, "CUTOFFS: %llu, BY THE FIRST ACTION: %llu (%.1f%%)\n",
+        (unsigned long long)search_stats.cutoffs,
+        (unsigned long long)search_stats.first_cutoffs,
+        search_stats.cutoffs ?
+            100.0 * search_stats.first_cutoffs / search_stats.cutoffs : 0.0);
+    fprintf(stream, "SEARCHES CONTINUED FROM THE LAST ONE: %llu\n",
+        (unsigned long long)search_stats.pv_hits);
+    if (search_stats.ponders) {
+        fprintf(stream, "PONDERED TURNS: %llu, EXPECTED REPLIES: %llu "
+            "(%.1f%%)\n", (unsigned long long)search_stats.ponders,
+            (unsigned long long)search_stats.ponder_hits,
+            100.0 * search_stats.ponder_hits / search_stats.ponders);
+    }
+    if (search_stats.qnodes) {
+        fprintf(stream, "QUIESCENCE NODES: %llu (%.1f%% of all nodes)\n",
+            (unsigned long long)search_stats.qnodes,
+            100.0 * search_stats.qnodes
+                / (search_stats.nodes + search_stats.qnodes));
+    }
+    if (endgame_db.map) {
+        fprintf(stream, "ENDGAME DATABASE HITS: %llu\n",
+            (unsigned long long)search_stats.egdb_hits);
+    }
+    if (opening_book.map) {
+        fprintf(stream, "OPENING BOOK HITS: %llu\n",
+            (unsigned long long)search_stats.book_hits);
+    }
+    tt_report(stream);
+}
+
+/* Prints the search of the computed action `best_action` of `turn` to
+    `stream`, as a line of text or a JSON object depending on `format`: its
+    depth, nodes, time, effective branching factor (the number of actions
+    that would give as many nodes in a tree of uniform width), the share of
+    cutoffs made by the first action searched and the hash table hit rate.
+*/
+void
+print_search_info(FILE *stream, int turn, node_t *best_action,
+    search_info_t *info, int format) {
+    search_stats_t *stats = &info->stats;
+    double ebf = info->depth ? pow(stats->nodes, 1.0 / info->depth) : 0.0;
+    double first_rate = stats->cutoffs ?
+        (double)stats->first_cutoffs / stats->cutoffs : 0.0;
+    double hit_rate = stats->tt_probes ?
+        (double)stats->tt_hits / stats->tt_probes : 0.0;
+    double nodes_per_sec = info->time_ms > 0 ?
+        stats->nodes / info->time_ms * 1000 : 0.0;
+    char *action = best_action->action;
+    if (format == STATS_TEXT) {
+        fprintf(stream, "SEARCH #%d: %c%c-%c%c, DEPTH: %d, NODES: %llu, "
+            "QUIESCENCE NODES: %llu, TIME: %.3f ms, NODES/S: %.0f, "
+            "EBF: %.2f, CUTOFFS: %llu (%.1f%% FIRST), HASH HITS: %.1f%%\n",
+            turn, action[SRC_COL], action[SRC_ROW], action[TAR_COL],
+            action[TAR_ROW], info->depth, (unsigned long long)stats->nodes,
+            (unsigned long long)stats->qnodes, info->time_ms, nodes_per_sec,
+            ebf, (unsigned long long)stats->cutoffs, 100 * first_rate,
+            100 * hit_rate);
+        return;
+    }
+    fprintf(stream, "{\"turn\": %d, \"action\": \"%c%c-%c%c\", "
+        "\"cost\": %d, \"depth\": %d, \"nodes\": %llu, \"qnodes\": %llu, "
+        "\"time_ms\": %.3f, \"nodes_per_sec\": %.0f, \"ebf\": %.3f, "
+        "\"cutoffs\": %llu, \"first_cutoff_rate\": %.4f, "
+        "\"tt_hit_rate\": %.4f, \"book_hits\": %llu, \"egdb_hits\": %llu, "
+        "\"depth_ms\": [", turn, action[SRC_COL], action[SRC_ROW],
+        action[TAR_COL], action[TAR_ROW], best_action->cost, info->depth,
+        (unsigned long long)stats->nodes, (unsigned long long)stats->qnodes,
+        info->time_ms, nodes_per_sec, ebf,
+        (unsigned long long)stats->cutoffs, first_rate, hit_rate,
+        (unsigned long long)stats->book_hits,
+        (unsigned long long)stats->egdb_hits);
+    for (int d=1; d<=info->depth; d++) {
+        fprintf(stream, "%s%.3f", d > 1 ? ", " : "", info->depth_ms[d]);
+    }
+    fprintf(stream, "], \"depth_nodes\": [");
+    for (int d=1; d<=info->depth; d++) {
+        fprintf(stream, "%s%llu", d > 1 ? ", " : "",
+            (unsigned long long)info->depth_nodes[d]);
+    }
+    fprintf(stream, "]}\n");
+}
+
+/* Searches the `board` with minimax for `player` (see minimax_node), calling
+    the copy of the search specialized for that colour. Inlined, so the
+    search itself calls the copy of the opponent directly.
+*/
+SPECIALIZED int
+minimax(search_t *search, int depth, int max_depth, board_t *board,
+    int player, int alpha, int beta) {
+    if (player == BLACK) {
+        return minimax_black(search, depth, max_depth, board, alpha, beta);
+    }
+    return minimax_white(search, depth, max_depth, board, alpha, beta);
+}
+
+/* The minimax search with black to move.
+*/
+int
+minimax_black(search_t *search, int depth, int max_depth, board_t *board,
+    int alpha, int beta) {
+    return minimax_node(search, depth, max_depth, board, BLACK, alpha, beta);
+}
+
+/* The minimax search with white to move.
+*/
+int
+minimax_white(search_t *search, int depth, int max_depth, board_t *board,
+    int alpha, int beta) {
+    return minimax_node(search, depth, max_depth, board, WHITE, alpha, beta);
+}
+
+/* Recursive function that applies the minimax algorithm till a specific `depth`
+    to the current `board` and returns the cost of the board. The best action
+    at the root is stored in `search->root_move`.
+    Branches are pruned with alpha-beta: `alpha` is the cost black is already
+    guaranteed and `beta` the cost white is already guaranteed. After the first
+    action, the others are only checked with a null window around the best cost
+    (principal variation search) and fully searched again if they beat it.
+    The root must be called with the full window [INT_MIN, INT_MAX] so its cost
+    and action are exactly those of a plain minimax search.
+    Costs are shared through the transposition table, which is only trusted
+    for positions searched to the same remaining depth so the result does not
+    depend on the order positions were reached in. Searches with quiescence
+    use keys of their own, since their costs differ.
+    Valid actions are kept in a buffer for each depth in `search`, so the
+    search does not allocate any memory. They are searched in the order of
+    score_moves, and at the root a tie with the best cost goes to the action
+    that was generated first, as in a plain minimax search.
+    Only inlined into minimax_black and minimax_white, so `player` is always
+    known at compile time.
+*/
+SPECIALIZED int
+minimax_node(search_t *search, int depth, int max_depth, board_t *board,
+    int player, int alpha, int beta) {
+    // Terminate if the search is out of time or nodes
+    search->stats.nodes++;
+    if (search->stopped || is_limit_reached(search)) {
+        search->stopped = TRUE;
+        return 0;
+    }
+
+    // Terminate if leaf node is reached
+    if (depth == max_depth) {
+        int value;
+        if (endgame_db.map && egdb_probe(board, player, &value)) {
+            COUNT(search, egdb_hits);
+            return egdb_cost(value, player);
+        }
+        if (search->quiescence) {
+            return quiescence(search, board, player, alpha, beta);
+        }
+        return calculate_cost(board);
+    }
+
+    // Look up the position in the transposition table
+    int remaining = max_depth - depth;
+    move_t hash_move = NO_MOVE;
+    tt_entry_t entry;
+    COUNT(search, tt_probes);
+    uint64_t key = board->hash ^ search->variant;
+    if (tt_probe(key, &entry)) {
+        COUNT(search, tt_hits);
+        int bound = entry.flags & ((1 << BOUND_BITS) - 1);
+        if (depth != ROOT_DEPTH && entry.depth == remaining
+            && (bound == BOUND_EXACT
+                || (bound == BOUND_LOWER && entry.cost >= beta)
+                || (bound == BOUND_UPPER && entry.cost <= alpha))) {
+            COUNT(search, tt_cutoffs);
+            return entry.cost;
+        }
+        hash_move = entry.move;
+    }
+    int alpha_orig = alpha, beta_orig = beta;
+    
+    // Set different node costs and opponents depending on player
+    int best_cost, opp;
+    if (player == BLACK) {  // maimising player
+        best_cost = INT_MIN;
+        opp = WHITE;
+    } else {                // minimising player
+        best_cost = INT_MAX;
+        opp = BLACK;
+    }
+
+    // Get this node's valid actions and score them for ordering
+    move_t *moves = search->moves[depth];
+    int *scores = search->scores[depth];
+    int num_moves = generate_actions(board, player, moves, FALSE);
+    if (depth == ROOT_DEPTH) {
+        memcpy(search->root_order, moves, num_moves * sizeof(move_t));
+    }
+    score_moves(search, board, player, depth, hash_move, moves, scores,
+        num_moves);
+
+    // Traverse through the valid actions
+    move_t best_move = NO_MOVE;
+    int best_index = MAX_MOVES;     // generated index of the best root action
+    for (int i=0; i<num_moves; i++) {
+        pick_move(moves, scores, i, num_moves);
+        move_t move = moves[i];
+
+        // at the root, actions generated before the best action win ties
+        int index = (depth == ROOT_DEPTH) ?
+            generated_index(search, num_moves, move) : MAX_MOVES;
+        int wins_tie = best_move != NO_MOVE && index < best_index;
+        if (i > 0 && !wins_tie
+            && ((player == BLACK && alpha == INT_MAX)
+                || (player == WHITE && beta == INT_MIN))) {
+            continue;   // the root already has the best possible cost
+        }
+
+        // perform the current action onto the board
+        undo_t undo;
+#ifdef DEBUG
+        board_t board_before = *board;
+#endif
+        make_move(board, move, player, &undo);
+
+        // recursive call find the cost of the leaf node
+        int cost;
+        if (i == 0) {
+            // the first action is searched with the full window
+            cost = minimax(search, depth+1, max_depth, board, opp, alpha,
+                beta);
+        } else if (player == BLACK) {
+            // only check if the action is better than alpha (or as good if it
+            // wins ties) ...
+            int bar = wins_tie ? alpha-1 : alpha;
+            cost = minimax(search, depth+1, max_depth, board, opp, bar,
+                bar+1);
+            if (cost > bar && cost < beta) {
+                // ... and find its exact cost if it is
+                cost = minimax(search, depth+1, max_depth, board, opp,
+                    bar, beta);
+            }
+        } else {
+            // only check if the action is better than beta (or as good if it
+            // wins ties) ...
+            int bar = wins_tie ? beta+1 : beta;
+            cost = minimax(search, depth+1, max_depth, board, opp, bar-1,
+                bar);
+            if (cost < bar && cost > alpha) {
+                // ... and find its exact cost if it is
+                cost = minimax(search, depth+1, max_depth, board, opp,
+                    alpha, bar);
+            }
+        }
+
+        // and take it back
+        unmake_move(board, move, player, &undo);
+#ifdef DEBUG
+        assert(memcmp(board, &board_before, sizeof(board_t)) == 0);
+#endif
+        if (search->stopped) {
+            break;
+        }
+
+        // compare the leaf cost with the best cost
+        if ((player == BLACK && (cost > best_cost
+                || (wins_tie && cost == best_cost)))
+            || (player == WHITE && (cost < best_cost
+                || (wins_tie && cost == best_cost)))) {
+            best_cost = cost;
+            best_move = move;
+            best_index = index;
+        }
+
+        // narrow the window and prune the remaining actions if it closes
+        if (player == BLACK && best_cost > alpha) {
+            alpha = best_cost;
+        } else if (player == WHITE && best_cost < beta) {
+            beta = best_cost;
+        }
+        if (alpha >= beta && depth != ROOT_DEPTH) {
+            COUNT(search, cutoffs);
+            if (i == 0) {
+                COUNT(search, first_cutoffs);
+            }
+            update_ordering(search, board, player, depth, remaining, move);
+            break;
+        }
+    }
+    if (search->stopped) {  // the cost is unfinished, don't remember it
+        return best_cost;
+    }
+    if (depth == ROOT_DEPTH) {
+        // remember the root action with the best cost
+        search->root_move = best_move;
+    }
+
+    // Remember the cost (or the bound on it) for the next time
+    int bound = BOUND_EXACT;
+    if (best_cost <= alpha_orig) {
+        bound = BOUND_UPPER;
+    } else if (best_cost >= beta_orig) {
+        bound = BOUND_LOWER;
+    }
+    tt_store(key, remaining, bound, best_cost, best_move);
+    COUNT(search, tt_stores);
+    return best_cost;
+}
+
+/* Runs the quiescence search (see quiescence_node) with the copy specialized
+    for `player`.
+*/
+SPECIALIZED int
+quiescence(search_t *search, board_t *board, int player, int alpha,
+    int beta) {
+    if (player == BLACK) {
+        return quiescence_black(search, board, alpha, beta);
+    }
+    return quiescence_white(search, board, alpha, beta);
+}
+
+/* The quiescence search with black to move.
+*/
+int
+quiescence_black(search_t *search, board_t *board, int alpha, int beta) {
+    return quiescence_node(search, board, BLACK, alpha, beta);
+}
+
+/* The quiescence search with white to move.
+*/
+int
+quiescence_white(search_t *search, board_t *board, int alpha, int beta) {
+    return quiescence_node(search, board, WHITE, alpha, beta);
+}
+
+/* Searches only the captures that follow a leaf of minimax, so the board is
+    not judged in the middle of an exchange. The player to move may also stop
+    capturing and keep the cost of the board as it is (stand pat), which
+    prunes the captures if that cost is already outside [`alpha`, `beta`].
+    Every capture removes a piece, so the search always ends; it checks no
+    limits and is not remembered in the transposition table.
+*/
+SPECIALIZED int
+quiescence_node(search_t *search, board_t *board, int player, int alpha,
+    int beta) {
+    COUNT(search, qnodes);
+
+    // Stand pat with the cost of the board as it is
+    int best_cost = calculate_cost(board);
+    if (player == BLACK) {
+        if (best_cost >= beta) {
+            return best_cost;
+        }
+        if (best_cost > alpha) {
+            alpha = best_cost;
+        }
+    } else {
+        if (best_cost <= alpha) {
+            return best_cost;
+        }
+        if (best_cost < beta) {
+            beta = best_cost;
+        }
+    }
+
+    // Try to do better by capturing
+    move_t moves[MAX_MOVES];
+    int num_moves = generate_actions(board, player, moves, TRUE);
+    for (int i=0; i<num_moves; i++) {
+        undo_t undo;
+        make_move(board, moves[i], player, &undo);
+        int cost = quiescence(search, board, !player, alpha, beta);
+        unmake_move(board, moves[i], player, &undo);
+        if (player == BLACK && cost > best_cost) {
+            best_cost = cost;
+            alpha = cost > alpha ? cost : alpha;
+        } else if (player == WHITE && cost < best_cost) {
+            best_cost = cost;
+            beta = cost < beta ? cost : beta;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+    return best_cost;
+}
+
+/* ------------------------ Minimax Helper Functions ------------------------ */
+/* Returns TRUE if the search has reached its node or time limit, or if it is
+    a helper search that the main thread has stopped or a search stopped from
+    outside. Limits (and stops from outside) are not checked until the first
+    depth has been completed.
+*/
+int
+is_limit_reached(search_t *search) {
+    if (atomic_load_explicit(search->abort, memory_order_relaxed)) {
+        return TRUE;
+    }
+    if (!search->completed) {
+        return FALSE;
+    }
+    if (search->stop
+        && atomic_load_explicit(search->stop, memory_order_relaxed)) {
+        return TRUE;
+    }
+    if (search->max_nodes && search->stats.nodes >= search->max_nodes) {
+        return TRUE;
+    }
+    // the clock is only checked every so often since it is slow to read
+    return search->time_ms && (search->stats.nodes & CHECK_INTERVAL) == 0
+        && now_ms() - search->start_ms >= search->time_ms;
+}
+
+/* Returns the current time in milliseconds (from an arbitrary start).
+*/
+double
+now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+/* Find valid moves for the board for the current player and stores them in
+    `moves`. Returns the number of valid moves (see generate_actions).
+*/
+int
+get_valid_actions(board_t *board, int player, move_t *moves) {
+    if (player == BLACK) {
+        return generate_actions(board, BLACK, moves, FALSE);
+    }
+    return generate_actions(board, WHITE, moves, FALSE);
+}
+
+/* Finds the captures of the current player and stores them in `moves`, in
+    the same order as get_valid_actions. Returns the number of captures.
+*/
+int
+get_captures(board_t *board, int player, move_t *moves) {
+    if (player == BLACK) {
+        return generate_actions(board, BLACK, moves, TRUE);
+    }
+    return generate_actions(board, WHITE, moves, TRUE);
+}
+
+/* Stores the valid actions of `player` (only its captures if
+    `captures_only`) in `moves` and returns their number. All one step moves
+    and captures are found at once with shifts and masks on the bitboard, then
+    added in row-major order of their source cell, checking north-east,
+    south-east, south-west and north-west. Inlined with a constant `player`
+    and `captures_only`, so the directions its pieces move in are known at
+    compile time.
+*/
+SPECIALIZED int
+generate_actions(board_t *board, int player, move_t *moves,
+    int captures_only) {
+    bitboard_t opp = board->pieces[!player] | board->towers[!player];
+    bitboard_t step_src[NUM_DIRS], jump_src[NUM_DIRS];
+    bitboard_t sources = 0;
+
+    // Find the cells that can move or capture in each direction
+    for (int dir=0; dir<NUM_DIRS; dir++) {
+        bitboard_t movers = board->towers[player];
+        if (IS_FORWARD[player][dir]) {
+            movers |= board->pieces[player];
+        }
+        step_src[dir] = captures_only ? 0
+            : movers & step_back(board->empty, dir);
+        jump_src[dir] = movers & JUMP_MASK[dir] & step_back(opp, dir)
+            & SHIFT(board->empty, -JUMP[dir]);
+        sources |= step_src[dir] | jump_src[dir];
+    }
+
+    // Traversing the source cells in row-major order
+    int num_moves = 0;
+    while (sources) {
+        int sq = first_bit(sources);
+        sources &= sources - 1;
+        for (int dir=0; dir<NUM_DIRS; dir++) {
+            if (step_src[dir] & SQUARE_BIT(sq)) {
+                moves[num_moves++] = ENCODE_MOVE(sq, step_squares[sq][dir]);
+            } else if (jump_src[dir] & SQUARE_BIT(sq)) {
+                moves[num_moves++] = ENCODE_MOVE(sq, jump_squares[sq][dir]);
+            }
+        }
+    }
+    return num_moves;
+}
+
+/* Scores the valid actions for ordering: the best action found before (the
+    hash move) first, then captures, pieces turning into towers, the killer
+    actions of this depth and the rest by their history score.
+*/
+void
+score_moves(search_t *search, board_t *board, int player, int depth,
+    move_t hash_move, move_t *moves, int *scores, int num_moves) {
+    for (int i=0; i<num_moves; i++) {
+        move_t move = moves[i];
+        if (move == hash_move) {
+            scores[i] = SCORE_HASH;
+        } else if (is_capture(move)) {
+            scores[i] = SCORE_CAPTURE;
+        } else if (is_promotion(board, player, move)) {
+            scores[i] = SCORE_PROMOTION;
+        } else if (move == search->killers[depth][0]) {
+            scores[i] = SCORE_KILLER + 1;
+        } else if (move == search->killers[depth][1]) {
+            scores[i] = SCORE_KILLER;
+        } else {
+            scores[i] = search->history[player][move];
+        }
+    }
+}
+
+/* Swaps the highest scored action from `index` onwards into `index`, so the
+    actions only get sorted as far as they are searched.
+*/
+void
+pick_move(move_t *moves, int *scores, int index, int num_moves) {
+    int best = index;
+    for (int i=index+1; i<num_moves; i++) {
+        if (scores[i] > scores[best]) {
+            best = i;
+        }
+    }
+    move_t move = moves[index];
+    int score = scores[index];
+    moves[index] = moves[best];
+    scores[index] = scores[best];
+    moves[best] = move;
+    scores[best] = score;
+}
+
+/* Remembers that `move` pruned the remaining actions: as a killer action for
+    this depth and in the history of the player (unless it is a capture or
+    promotion, which are searched early anyway).
+*/
+void
+update_ordering(search_t *search, board_t *board, int player, int depth,
+    int remaining, move_t move) {
+    if (is_capture(move) || is_promotion(board, player, move)) {
+        return;
+    }
+    if (search->killers[depth][0] != move) {
+        search->killers[depth][1] = search->killers[depth][0];
+        search->killers[depth][0] = move;
+    }
+    int *history = search->history[player];
+    history[move] += remaining * remaining;
+    if (history[move] > MAX_HISTORY) {   // keep history below the killers
+        for (int i=0; i<NUM_SQUARES*NUM_SQUARES; i++) {
+            history[i] /= 2;
+        }
+    }
+}
+
+/* Returns TRUE if `move` captures a piece or tower.
+*/
+int
+is_capture(move_t move) {
+    return move_captures[move] != NO_SQUARE;
+}
+
+/* Returns TRUE if `move` turns one of the player's pieces into a tower.
+*/
+int
+is_promotion(board_t *board, int player, move_t move) {
+    int tar_row = SQUARE_ROW(MOVE_TAR(move));
+    return (board->pieces[player] & SQUARE_BIT(MOVE_SRC(move)))
+        && tar_row == TOWER_ROW[player];
+}
+
+/* Returns the index of the root action `move` in the generated order.
+*/
+int
+generated_index(search_t *search, int num_moves, move_t move) {
+    for (int i=0; i<num_moves; i++) {
+        if (search->root_order[i] == move) {
+            return i;
+        }
+    }
+    return MAX_MOVES;
+}
+
+/* -------------------------- Pondering Functions --------------------------- */
+/* Starts searching the board after the reply the last search in `memory`
+    expects to the `board`, on a thread of its own, while the human thinks.
+    The search has no time or node limit and runs until it reaches
+    `options->depth` or is stopped. Returns FALSE if there is no expected
+    reply, in which case nothing is started.
+*/
+int
+start_pondering(ponder_t *ponder, board_t *board, options_t *options,
+    search_memory_t *memory) {
+    if (memory->pv_len < 2 || memory->hashes[1] != board->hash) {
+        return FALSE;
+    }
+    ponder->board = *board;
+    undo_t undo;
+    make_move(&ponder->board, memory->pv[1], WHITE, &undo);
+    ponder->options = *options;
+    ponder->options.time_ms = 0;
+    ponder->options.max_nodes = 0;
+    ponder->options.stop = &ponder->stop;
+    ponder->memory = *memory;
+    ponder->best_action = NULL;
+    atomic_store(&ponder->stop, FALSE);
+    int error = pthread_create(&ponder->thread, NULL, ponder_worker, ponder);
+    assert(!error);
+    return TRUE;
+}
+
+/* Runs the search of the pondering `arg`.
+*/
+void
+*ponder_worker(void *arg) {
+    ponder_t *ponder = (ponder_t*)arg;
+    node_t *best_action = iterative_deepening(&ponder->board, BLACK,
+        &ponder->options, &ponder->memory, &ponder->info);
+    if (ponder->info.depth == ponder->options.depth
+        || best_action->cost == INT_MAX || best_action->cost == INT_MIN) {
+        ponder->best_action = best_action;  // nothing left to search
+    } else {
+        free(best_action);
+    }
+    return NULL;
+}
+
+/* Stops the pondering search now that the human's action has been done on
+    the `board`. If it was the expected reply, the search is kept: its action
+    is returned if it already searched every depth, and otherwise `memory`
+    takes its place so the bot's search continues from it. If not, the search
+    is thrown away and NULL is returned.
+*/
+node_t
+*stop_pondering(ponder_t *ponder, board_t *board, search_memory_t *memory) {
+    atomic_store(&ponder->stop, TRUE);
+    pthread_join(ponder->thread, NULL);
+    search_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.ponders = 1;
+    node_t *best_action = NULL;
+    if (board->hash == ponder->board.hash) {
+        stats.ponder_hits = 1;
+        *memory = ponder->memory;
+        best_action = ponder->best_action;
+    } else {
+        free(ponder->best_action);
+    }
+    pthread_mutex_lock(&search_stats_lock);
+    add_stats(&search_stats, &stats);
+    pthread_mutex_unlock(&search_stats_lock);
+    return best_action;
+}
+
+/* ------------------------- Game Record Functions -------------------------- */
+
+/* Creates the binary record file at `path` and writes its header. Returns
+    FALSE if the file cannot be created.
+*/
+int
+open_record_writer(record_writer_t *writer, char *path, int flags) {
+    writer->stream = fopen(path, "wb");
+    if (!writer->stream) {
+        return FALSE;
+    }
+    writer->flags = flags;
+    writer->computed = FALSE;
+    fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_LEN, writer->stream);
+    putc(RECORD_VERSION, writer->stream);
+    putc(flags, writer->stream);
+    return TRUE;
+}
+
+/* Appends `move` to the current game, with the hash and cost of the `board`
+    after it if the record has RECORD_EVALS.
+*/
+void
+write_ply(record_writer_t *writer, move_t move, board_t *board,
+    int is_computed) {
+    if (is_computed && !writer->computed) {
+        putc(RECORD_COMPUTED, writer->stream);
+        writer->computed = TRUE;
+    }
+    putc(encode_move(move), writer->stream);
+    if (writer->flags & RECORD_EVALS) {
+        write_le(writer->stream, board->hash, HASH_BYTES);
+        write_le(writer->stream, (uint32_t)display_cost(board), COST_BYTES);
+    }
+}
+
+/* Ends the current game with its `command` (or DASH), so the next ply
+    starts a new game.
+*/
+void
+end_game_record(record_writer_t *writer, char command) {
+    putc(RECORD_END, writer->stream);
+    putc(command, writer->stream);
+    writer->computed = FALSE;
+}
+
+/* Closes the record file. Returns FALSE if it could not be written.
+*/
+int
+close_record_writer(record_writer_t *writer) {
+    int is_ok = !ferror(writer->stream);
+    return fclose(writer->stream) == 0 && is_ok;
+}
+
+/* Opens the binary record file at `path` and reads its header. Returns
+    FALSE if the file cannot be opened or is not a binary record.
+*/
+int
+open_record_reader(record_reader_t *reader, char *path) {
+    reader->stream = fopen(path, "rb");
+    if (!reader->stream) {
+        return FALSE;
+    }
+    char magic[RECORD_MAGIC_LEN];
+    int version;
+    if (fread(magic, 1, RECORD_MAGIC_LEN, reader->stream) != RECORD_MAGIC_LEN
+        || memcmp(magic, RECORD_MAGIC, RECORD_MAGIC_LEN) != 0
+        || (version = getc(reader->stream)) != RECORD_VERSION
+        || (reader->flags = getc(reader->stream)) == EOF) {
+        fclose(reader->stream);
+        return FALSE;
+    }
+    fill_initial_board(&reader->board);
+    reader->turn = 1;
+    reader->computed = FALSE;
+    reader->command = DASH;
+    return TRUE;
+}
+
+/* Reads the next ply of the record into `move` and performs it on the
+    reader's board. Returns PLY_MOVE after a ply, PLY_GAME_END at the end of
+    a game (the next ply starts a new game from the initial board), PLY_EOF
+    when there are no more games and PLY_ERROR if the record is damaged or
+    has an illegal ply or a hash or cost that does not match its board.
+*/
+int
+read_ply(record_reader_t *reader, move_t *move) {
+    int code = getc(reader->stream);
+    if (code == RECORD_COMPUTED && !reader->computed) {
+        reader->computed = TRUE;
+        code = getc(reader->stream);
+    }
+    if (code == EOF) {
+        // a game may only end at the end of the file if it has no plies
+        return reader->turn == 1 && !reader->computed ? PLY_EOF : PLY_ERROR;
+    } else if (code == RECORD_END) {
+        int command = getc(reader->stream);
+        if (command == EOF) {
+            return PLY_ERROR;
+        }
+        reader->command = command;
+        fill_initial_board(&reader->board);
+        reader->turn = 1;
+        reader->computed = FALSE;
+        return PLY_GAME_END;
+    }
+
+    // the ply must be one of the valid actions of the board
+    int player = reader->turn % NUM_PLAYERS;
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(&reader->board, player, moves);
+    *move = decode_move(code);
+    int is_valid = FALSE;
+    for (int i=0; i<num_moves; i++) {
+        is_valid |= moves[i] == *move;
+    }
+    if (*move == NO_MOVE || !is_valid) {
+        return PLY_ERROR;
+    }
+    undo_t undo;
+    make_move(&reader->board, *move, player, &undo);
+    reader->turn++;
+
+    if (reader->flags & RECORD_EVALS) {
+        uint64_t hash, cost;
+        if (!read_le(reader->stream, &hash, HASH_BYTES)
+            || !read_le(reader->stream, &cost, COST_BYTES)
+            || hash != reader->board.hash
+            || (int32_t)cost != display_cost(&reader->board)) {
+            return PLY_ERROR;
+        }
+    }
+    return PLY_MOVE;
+}
+
+/* Closes the record file of `reader`.
+*/
+void
+close_record_reader(record_reader_t *reader) {
+    fclose(reader->stream);
+}
+
+/* Packs `move` into one byte: its source square, its direction and whether
+    it is a jump.
+*/
+uint8_t
+encode_move(move_t move) {
+    int src = MOVE_SRC(move), tar = MOVE_TAR(move);
+    for (int dir=0; dir<NUM_DIRS; dir++) {
+        if (tar == step_squares[src][dir]) {
+            return src | dir << RECORD_DIR_SHIFT;
+        } else if (tar == jump_squares[src][dir]) {
+            return src | dir << RECORD_DIR_SHIFT | RECORD_JUMP;
+        }
+    }
+    assert(FALSE);
+    return RECORD_END;
+}
+
+/* Unpacks a move packed by encode_move. Returns NO_MOVE if the move would
+    leave the board (like RECORD_END and RECORD_COMPUTED).
+*/
+move_t
+decode_move(uint8_t code) {
+    int src = code & RECORD_SQUARE_MASK;
+    int dir = (code >> RECORD_DIR_SHIFT) % NUM_DIRS;
+    int tar = (code & RECORD_JUMP) ? jump_squares[src][dir]
+        : step_squares[src][dir];
+    if (tar == NO_SQUARE) {
+        return NO_MOVE;
+    }
+    return ENCODE_MOVE(src, tar);
+}
+
+/* Writes the lowest `num_bytes` bytes of `value`, lowest byte first.
+*/
+void
+write_le(FILE *stream, uint64_t value, int num_bytes) {
+    for (int i=0; i<num_bytes; i++) {
+        putc((value >> (i*CHAR_BIT)) & UCHAR_MAX, stream);
+    }
+}
+
+/* Reads a `num_bytes` bytes value written by write_le into `value`. Returns
+    FALSE at the end of the file.
+*/
+int
+read_le(FILE *stream, uint64_t *value, int num_bytes) {
+    *value = 0;
+    for (int i=0; i<num_bytes; i++) {
+        int byte = getc(stream);
+        if (byte == EOF) {
+            return FALSE;
+        }
+        *value |= (uint64_t)byte << (i*CHAR_BIT);
+    }
+    return TRUE;
+}
+
+/* ----------------------- Endgame Database Functions ----------------------- */
+
+/* Fills the table of binomial coefficients used to rank piece placements.
+*/
+void
+init_binomials(void) {
+    for (int n=0; n<=NUM_SQUARES; n++) {
+        binomials[n][0] = 1;
+        for (int k=1; k<=EGDB_MAX_PIECES; k++) {
+            binomials[n][k] = n ? binomials[n-1][k-1] + binomials[n-1][k] : 0;
+        }
+    }
+}
+
+/* Returns the signature of the slice with `counts` pieces of each type.
+*/
+int
+egdb_signature(int *counts) {
+    int signature = 0;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        signature = signature * (EGDB_MAX_PIECES+1) + counts[type];
+    }
+    return signature;
+}
+
+/* Returns the number of ways to place `counts` pieces of each type.
+*/
+uint64_t
+egdb_num_boards(int *counts) {
+    uint64_t num_boards = 1;
+    int free_squares = NUM_SQUARES;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        num_boards *= binomials[free_squares][counts[type]];
+        free_squares -= counts[type];
+    }
+    return num_boards;
+}
+
+/* Returns the index of the `board`'s piece placement within its slice, whose
+    signature is stored in `signature`. The squares of each type are ranked
+    (combinatorial number system) among the squares left free by the types
+    before it, and the ranks are combined as the digits of a mixed-radix
+    number, so every placement of the slice has its own index below
+    egdb_num_boards.
+*/
+uint64_t
+egdb_rank(board_t *board, int *signature) {
+    int counts[NUM_PIECE_TYPES];
+    uint64_t index = 0;
+    bitboard_t occupied = 0;
+    int free_squares = NUM_SQUARES;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        bitboard_t cells = *type_cells(board, type);
+        counts[type] = count_bits(cells);
+        uint64_t rank = 0;
+        for (int i=0; cells; i++) {
+            int sq = first_bit(cells);
+            cells &= cells - 1;
+            int free_index = sq - count_bits(occupied & (SQUARE_BIT(sq) - 1));
+            rank += binomials[free_index][i+1];
+        }
+        index = index * binomials[free_squares][counts[type]] + rank;
+        occupied |= *type_cells(board, type);
+        free_squares -= counts[type];
+    }
+    *signature = egdb_signature(counts);
+    return index;
+}
+
+/* Sets up the `board` with the piece placement of index `index` in the slice
+    with `counts` pieces of each type (the inverse of egdb_rank).
+*/
+void
+egdb_unrank(uint64_t index, int *counts, board_t *board) {
+    // split the index into the rank of each type
+    uint64_t ranks[NUM_PIECE_TYPES], radixes[NUM_PIECE_TYPES];
+    int free_squares = NUM_SQUARES;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        radixes[type] = binomials[free_squares][counts[type]];
+        free_squares -= counts[type];
+    }
+    for (int type=NUM_PIECE_TYPES-1; type>=0; type--) {
+        ranks[type] = index % radixes[type];
+        index /= radixes[type];
+    }
+
+    memset(board, 0, sizeof(board_t));
+    bitboard_t occupied = 0;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        bitboard_t *cells = type_cells(board, type);
+        uint64_t rank = ranks[type];
+        for (int i=counts[type]; i>0; i--) {
+            // the largest free index whose binomial fits in the rank
+            int free_index = i - 1;
+            while (binomials[free_index+1][i] <= rank) {
+                free_index++;
+            }
+            rank -= binomials[free_index][i];
+
+            // the square of that free index
+            int sq = 0;
+            for (int skipped=0; ; sq++) {
+                if (!(occupied & SQUARE_BIT(sq)) && skipped++ == free_index) {
+                    break;
+                }
+            }
+            *cells |= SQUARE_BIT(sq);
+        }
+        occupied |= *cells;
+    }
+    board->empty = ~occupied;
+    board->hash = hash_board(board);
+    board->cost = count_cost(board);
+}
+
+/* Memory-maps the endgame database at `path` to be probed by the search.
+    Returns FALSE if the file cannot be read or is not an endgame database.
+*/
+int
+egdb_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return FALSE;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0
+        || (size_t)file_stat.st_size < sizeof(egdb_header_t)) {
+        close(fd);
+        return FALSE;
+    }
+    size_t size = file_stat.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return FALSE;
+    }
+
+    egdb_header_t *header = (egdb_header_t*)map;
+    egdb_slice_t *slices = (egdb_slice_t*)(map + sizeof(egdb_header_t));
+    if (memcmp(header->magic, EGDB_MAGIC, RECORD_MAGIC_LEN) != 0
+        || header->version != EGDB_VERSION
+        || header->max_pieces > EGDB_MAX_PIECES
+        || sizeof(egdb_header_t) + header->num_slices * sizeof(egdb_slice_t)
+            > size) {
+        munmap(map, size);
+        return FALSE;
+    }
+    memset(&endgame_db, 0, sizeof(endgame_db));
+    for (uint32_t i=0; i<header->num_slices; i++) {
+        if (!egdb_check_slice(&slices[i], header->max_pieces, map, size)) {
+            munmap(map, size);
+            return FALSE;
+        }
+        int counts[NUM_PIECE_TYPES];
+        for (int type=0; type<NUM_PIECE_TYPES; type++) {
+            counts[type] = slices[i].counts[type];
+        }
+        endgame_db.slice_of[egdb_signature(counts)] = &slices[i];
+    }
+    endgame_db.map = map;
+    endgame_db.size = size;
+    endgame_db.max_pieces = header->max_pieces;
+    return TRUE;
+}
+
+/* Returns FALSE if the `slice` of the endgame database mapped at `map` (of
+    `size` bytes) is damaged: more than `max_pieces` pieces, a table size
+    that does not match them, or block offsets outside the file.
+*/
+int
+egdb_check_slice(egdb_slice_t *slice, uint32_t max_pieces, uint8_t *map,
+    size_t size) {
+    int counts[NUM_PIECE_TYPES];
+    uint32_t num_pieces = 0;
+    for (int type=0; type<NUM_PIECE_TYPES; type++) {
+        counts[type] = slice->counts[type];
+        num_pieces += counts[type];
+    }
+    if (num_pieces > max_pieces
+        || slice->num_boards != egdb_num_boards(counts)
+        || slice->num_blocks != (slice->num_boards * NUM_PLAYERS
+            + EGDB_BLOCK_LEN - 1) / EGDB_BLOCK_LEN
+        || slice->offset % EGDB_ALIGN != 0 || slice->offset > size
+        || (size - slice->offset) / sizeof(uint64_t) < slice->num_blocks + 1) {
+        return FALSE;
+    }
+    uint64_t *offsets = (uint64_t*)(map + slice->offset);
+    for (uint32_t block=0; block<slice->num_blocks; block++) {
+        if (offsets[block] > offsets[block+1] || offsets[block+1] > size) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Unmaps the endgame database (if one is open).
+*/
+void
+egdb_close(void) {
+    if (endgame_db.map) {
+        munmap(endgame_db.map, endgame_db.size);
+        endgame_db.map = NULL;
+    }
+}
+
+/* Looks up the `board` with `player` to move in the endgame database and
+    stores its value in `value`. Returns FALSE if the board has too many
+    pieces to be in the database.
+*/
+int
+egdb_probe(board_t *board, int player, int *value) {
+    if (count_bits(~board->empty) > endgame_db.max_pieces) {
+        return FALSE;
+    }
+    int signature;
+    uint64_t index = egdb_rank(board, &signature);
+    egdb_slice_t *slice = endgame_db.slice_of[signature];
+    if (!slice) {
+        return FALSE;
+    }
+    uint64_t position = player * slice->num_boards + index;
+
+    // decode the block of the position up to the position
+    uint64_t *offsets = (uint64_t*)(endgame_db.map + slice->offset);
+    uint64_t block = position / EGDB_BLOCK_LEN;
+    uint64_t skip = position % EGDB_BLOCK_LEN;
+    uint8_t *code = endgame_db.map + offsets[block];
+    uint8_t *end = endgame_db.map + offsets[block+1];
+    while (code < end) {
+        int len = (*code & ~EGDB_LITERAL) + 1;
+        int is_literal = *code & EGDB_LITERAL;
+        if (skip < (uint64_t)len) {
+            uint8_t *at = code + 1 + (is_literal ? skip : 0);
+            if (at >= end) {
+                break;
+            }
+            *value = *at;
+            return TRUE;
+        }
+        skip -= len;
+        code += 1 + (is_literal ? len : 1);
+    }
+    return FALSE;   // a damaged block
+}
+
+/* Returns the cost of an endgame database `value` for `player` to move:
+    wins are worth EGDB_WIN_COST less their distance, so shorter wins (and
+    longer losses) are preferred.
+*/
+int
+egdb_cost(int value, int player) {
+    if (value == EGDB_DRAW) {
+        return 0;
+    }
+    int distance = value - 1;
+    // odd distances are won by the player to move
+    int cost = (distance % 2) ? EGDB_WIN_COST - distance
+        : distance - EGDB_WIN_COST;
+    return (player == BLACK) ? cost : -cost;
+}
+
+/* Finds the best action of the `board` with the endgame database and stores
+    it and its cost. Returns FALSE if the board is not in the database or has
+    no valid actions.
+*/
+int
+egdb_best_move(board_t *board, int player, move_t *best_move, int *cost) {
+    int value;
+    if (!egdb_probe(board, player, &value)) {
+        return FALSE;
+    }
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(board, player, moves);
+    *best_move = NO_MOVE;
+    for (int i=0; i<num_moves; i++) {
+        undo_t undo;
+        make_move(board, moves[i], player, &undo);
+        int found = egdb_probe(board, !player, &value);
+        unmake_move(board, moves[i], player, &undo);
+        if (!found) {
+            return FALSE;
+        }
+        int move_cost = egdb_cost(value, !player);
+        if (*best_move == NO_MOVE || (player == BLACK && move_cost > *cost)
+            || (player == WHITE && move_cost < *cost)) {
+            *best_move = moves[i];
+            *cost = move_cost;
+        }
+    }
+    return *best_move != NO_MOVE;
+}
+
+/* Generates the endgame database of every board with up to the given number
+    of pieces with retrograde analysis, on `options->threads` threads, and
+    writes it compressed to the given file. Progress and memory use are
+    reported to stderr.
+*/
+int
+run_endgame(options_t *options) {
+    int max_pieces = options->num_args > 1 ? atoi(options->args[1])
+        : EGDB_PIECES;
+    if (options->num_args < 1 || options->num_args > 2 || max_pieces < 1
+        || max_pieces > EGDB_MAX_PIECES) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    egdb_gen_t *gen = (egdb_gen_t*)calloc(1, sizeof(egdb_gen_t));
+    assert(gen!=NULL);
+    gen->max_pieces = max_pieces;
+    double start_ms = now_ms();
+    uint64_t table_bytes = 0;
+
+    // slices are generated in order of pieces, then of pieces that are not
+    // towers yet, so captures and promotions lead to generated slices
+    int num_slices = 0;
+    int slice_counts[EGDB_SIGNATURES][NUM_PIECE_TYPES];
+    for (int pieces=1; pieces<=max_pieces; pieces++) {
+        for (int towers=pieces; towers>=0; towers--) {
+            for (int w=0; w<=pieces-towers; w++) {
+                for (int w_towers=0; w_towers<=towers; w_towers++) {
+                    int counts[NUM_PIECE_TYPES] = {w, pieces-towers-w,
+                        w_towers, towers-w_towers};
+                    memcpy(slice_counts[num_slices++], counts, sizeof(counts));
+                    egdb_generate_slice(gen, counts, options->threads);
+                    table_bytes += gen->num_values;
+
+                    struct rusage usage;
+                    getrusage(RUSAGE_SELF, &usage);
+                    fprintf(stderr, "SLICE %d (w:%d b:%d W:%d B:%d): %llu "
+                        "positions, %d passes, %.1f s, TABLES: %llu KB, "
+                        "MAX RSS: %ld KB\n", num_slices, counts[0], counts[1],
+                        counts[2], counts[3],
+                        (unsigned long long)gen->num_values, gen->distance,
+                        (now_ms() - start_ms) / 1000,
+                        (unsigned long long)table_bytes / 1024,
+                        usage.ru_maxrss);
+                }
+            }
+        }
+    }
+
+    // write the header, the slices and then each slice's blocks
+    FILE *stream = fopen(options->args[0], "wb");
+    if (!stream) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+    egdb_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EGDB_MAGIC, RECORD_MAGIC_LEN);
+    header.version = EGDB_VERSION;
+    header.max_pieces = max_pieces;
+    header.num_slices = num_slices;
+    fwrite(&header, sizeof(header), 1, stream);
+    uint64_t offset = sizeof(header) + num_slices * sizeof(egdb_slice_t);
+    egdb_slice_t *slices = (egdb_slice_t*)calloc(num_slices,
+        sizeof(egdb_slice_t));
+    uint64_t **offsets = (uint64_t**)malloc(num_slices * sizeof(uint64_t*));
+    uint8_t **data = (uint8_t**)malloc(num_slices * sizeof(uint8_t*));
+    assert(slices!=NULL && offsets!=NULL && data!=NULL);
+    for (int i=0; i<num_slices; i++) {
+        int signature = egdb_signature(slice_counts[i]);
+        uint64_t num_values = egdb_num_boards(slice_counts[i]) * NUM_PLAYERS;
+        for (int type=0; type<NUM_PIECE_TYPES; type++) {
+            slices[i].counts[type] = slice_counts[i][type];
+        }
+        slices[i].num_blocks = (num_values + EGDB_BLOCK_LEN - 1)
+            / EGDB_BLOCK_LEN;
+        slices[i].num_boards = num_values / NUM_PLAYERS;
+        offset = (offset + EGDB_ALIGN - 1) / EGDB_ALIGN * EGDB_ALIGN;
+        slices[i].offset = offset;
+        offsets[i] = (uint64_t*)malloc((slices[i].num_blocks + 1)
+            * sizeof(uint64_t));
+        data[i] = (uint8_t*)malloc(2 * num_values);   // more than enough
+        assert(offsets[i]!=NULL && data[i]!=NULL);
+        offset += (slices[i].num_blocks + 1) * sizeof(uint64_t);
+        size_t len = egdb_compress(gen->tables[signature], num_values,
+            offsets[i], data[i]);
+        for (uint32_t block=0; block<=slices[i].num_blocks; block++) {
+            offsets[i][block] += offset;
+        }
+        offset += len;
+        free(gen->tables[signature]);
+    }
+    fwrite(slices, sizeof(egdb_slice_t), num_slices, stream);
+    for (int i=0; i<num_slices; i++) {
+        while ((uint64_t)ftell(stream) < slices[i].offset) {
+            putc(0, stream);
+        }
+        fwrite(offsets[i], sizeof(uint64_t), slices[i].num_blocks + 1, stream);
+        fwrite(data[i], 1, offsets[i][slices[i].num_blocks]
+            - offsets[i][0], stream);
+        free(offsets[i]);
+        free(data[i]);
+    }
+    int is_ok = !ferror(stream);
+    is_ok &= fclose(stream) == 0;
+    free(offsets);
+    free(data);
+    free(slices);
+    free(gen);
+    if (!is_ok) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "ENDGAME DATABASE: %d slices, %llu KB (%llu KB "
+        "uncompressed), %.1f s\n", num_slices,
+        (unsigned long long)offset / 1024,
+        (unsigned long long)table_bytes / 1024, (now_ms() - start_ms) / 1000);
+    return EXIT_SUCCESS;
+}
+
+/* Resolves the values of the slice with `counts` pieces of each type on
+    `threads` threads, one distance per pass: boards without valid actions
+    are lost at distance 0, boards with an action to a board lost at
+    distance d-1 are won at distance d and boards whose actions all lead to
+    boards won at distances up to d-1 (one of them d-1) are lost at
+    distance d. Boards never resolved are draws.
+*/
+void
+egdb_generate_slice(egdb_gen_t *gen, int *counts, int threads) {
+    gen->signature = egdb_signature(counts);
+    gen->num_boards[gen->signature] = egdb_num_boards(counts);
+    gen->num_values = gen->num_boards[gen->signature] * NUM_PLAYERS;
+    uint8_t *values = (uint8_t*)calloc(gen->num_values, 1);
+    gen->next = (uint8_t*)calloc(gen->num_values, 1);
+    assert(values!=NULL && gen->next!=NULL);
+    gen->tables[gen->signature] = values;
+
+    // a pass resolves boards whose actions lead to boards of distance d-1,
+    // so once a pass resolves none, and the slices that captures and
+    // promotions lead to have no longer distances, no later pass can
+    for (gen->distance=0; gen->distance<EGDB_MAX_VALUE-1; gen->distance++) {
+        atomic_store(&gen->next_chunk, 0);
+        atomic_store(&gen->resolved, 0);
+        pthread_t thread_ids[MAX_THREADS];
+        for (int i=1; i<threads; i++) {
+            int error = pthread_create(&thread_ids[i], NULL, egdb_worker, gen);
+            assert(!error);
+        }
+        egdb_worker(gen);
+        for (int i=1; i<threads; i++) {
+            pthread_join(thread_ids[i], NULL);
+        }
+        memcpy(values, gen->next, gen->num_values);
+        if (atomic_load(&gen->resolved)) {
+            if (gen->distance > gen->max_distance) {
+                gen->max_distance = gen->distance;
+            }
+        } else if (gen->distance > gen->max_distance) {
+            break;
+        }
+    }
+    free(gen->next);
+}
+
+/* Resolves chunks of boards of the slice being generated until none are left.
+*/
+void
+*egdb_worker(void *arg) {
+    egdb_gen_t *gen = (egdb_gen_t*)arg;
+    uint64_t start;
+    while ((start = atomic_fetch_add(&gen->next_chunk, EGDB_CHUNK_LEN))
+        < gen->num_values) {
+        uint64_t end = start + EGDB_CHUNK_LEN < gen->num_values ?
+            start + EGDB_CHUNK_LEN : gen->num_values;
+        uint64_t resolved = 0;
+        for (uint64_t i=start; i<end; i++) {
+            resolved += egdb_resolve(gen, i);
+        }
+        atomic_fetch_add(&gen->resolved, resolved);
+    }
+    return NULL;
+}
+
+/* Resolves the board at `value_index` of the slice being generated for the
+    pass's distance, writing its value to the next values. Returns TRUE if the
+    board was resolved.
+*/
+int
+egdb_resolve(egdb_gen_t *gen, uint64_t value_index) {
+    uint8_t *values = gen->tables[gen->signature];
+    if (values[value_index] != EGDB_DRAW) {
+        return FALSE;   // resolved by an earlier pass
+    }
+    int counts[NUM_PIECE_TYPES];
+    int signature = gen->signature;
+    for (int type=NUM_PIECE_TYPES-1; type>=0; type--) {
+        counts[type] = signature % (EGDB_MAX_PIECES+1);
+        signature /= EGDB_MAX_PIECES+1;
+    }
+    // the values of white to move come first, then those of black to move
+    board_t board;
+    uint64_t num_boards = gen->num_boards[gen->signature];
+    int player = value_index / num_boards;
+    egdb_unrank(value_index % num_boards, counts, &board);
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(&board, player, moves);
+    int distance = gen->distance;
+    if (num_moves == 0 || distance == 0) {
+        if (num_moves == 0) {
+            gen->next[value_index] = 1;     // lost at distance 0
+        }
+        return num_moves == 0;
+    }
+
+    int is_won = FALSE, is_lost = TRUE, longest = 0;
+    for (int i=0; i<num_moves && !is_won; i++) {
+        undo_t undo;
+        make_move(&board, moves[i], player, &undo);
+        int child_signature;
+        uint64_t child = egdb_rank(&board, &child_signature);
+        int value = gen->tables[child_signature][child
+            + !player * gen->num_boards[child_signature]];
+        unmake_move(&board, moves[i], player, &undo);
+
+        int child_distance = value - 1;
+        if (value == EGDB_DRAW) {
+            is_lost = FALSE;
+        } else if (child_distance % 2 == 0) {   // the opponent loses
+            is_lost = FALSE;
+            is_won = child_distance == distance - 1;
+        } else if (child_distance > longest) {
+            longest = child_distance;
+        }
+    }
+    if (is_won || (is_lost && longest == distance - 1)) {
+        gen->next[value_index] = distance + 1;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Returns the number of values equal to values[i] from i on, up to `max`.
+*/
+uint64_t
+egdb_run_length(uint8_t *values, uint64_t i, uint64_t max) {
+    uint64_t run = 1;
+    while (run < max && values[i+run] == values[i]) {
+        run++;
+    }
+    return run;
+}
+
+/* Compresses the `values` in blocks of EGDB_BLOCK_LEN into `data`, storing
+    the start of each block (and the end of the last) in `offsets`. Returns
+    the length of the data. Each code byte is followed by one value repeated
+    (code + 1) times, or with EGDB_LITERAL set, by (code - EGDB_LITERAL + 1)
+    different values.
+*/
+size_t
+egdb_compress(uint8_t *values, uint64_t num_values, uint64_t *offsets,
+    uint8_t *data) {
+    size_t len = 0;
+    uint64_t block = 0;
+    for (uint64_t i=0; i<num_values; ) {
+        if (i % EGDB_BLOCK_LEN == 0) {
+            offsets[block++] = len;
+        }
+        // codes end at block boundaries so blocks decode on their own
+        uint64_t left = EGDB_BLOCK_LEN - i % EGDB_BLOCK_LEN;
+        if (left > num_values - i) {
+            left = num_values - i;
+        }
+        if (left > EGDB_RUN_LEN) {
+            left = EGDB_RUN_LEN;
+        }
+        uint64_t run = egdb_run_length(values, i, left);
+        if (run >= EGDB_MIN_RUN || run == left) {
+            data[len++] = run - 1;
+            data[len++] = values[i];
+        } else {
+            // literals up to the next run worth a count
+            uint64_t literals = run;
+            while (literals < left
+                && egdb_run_length(values, i + literals, left - literals)
+                    < EGDB_MIN_RUN) {
+                literals++;
+            }
+            data[len++] = EGDB_LITERAL | (literals - 1);
+            memcpy(data + len, values + i, literals);
+            len += literals;
+            run = literals;
+        }
+        i += run;
+    }
+    offsets[block] = len;
+    return len;
+}
+
+/* ------------------------- Opening Book Functions ------------------------- */
+
+/* Memory-maps the opening book at `path` to be consulted before searching.
+    Returns FALSE if the file cannot be read or is not an opening book.
+*/
+int
+book_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return FALSE;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0
+        || (size_t)file_stat.st_size < sizeof(book_header_t)) {
+        close(fd);
+        return FALSE;
+    }
+    size_t size = file_stat.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return FALSE;
+    }
+    book_header_t *header = (book_header_t*)map;
+    if (memcmp(header->magic, BOOK_MAGIC, RECORD_MAGIC_LEN) != 0
+        || header->version != BOOK_VERSION
+        || sizeof(book_header_t) + header->num_entries * sizeof(book_entry_t)
+            > size) {
+        munmap(map, size);
+        return FALSE;
+    }
+    opening_book.map = map;
+    opening_book.size = size;
+    opening_book.entries = (book_entry_t*)(map + sizeof(book_header_t));
+    opening_book.num_entries = header->num_entries;
+    return TRUE;
+}
+
+/* Unmaps the opening book (if one is open).
+*/
+void
+book_close(void) {
+    if (opening_book.map) {
+        munmap(opening_book.map, opening_book.size);
+        opening_book.map = NULL;
+    }
+}
+
+/* Looks up the `board` with `player` to move in the opening book and stores
+    its most played action (the first of equally played ones) and its cost.
+    Returns FALSE if the board is not in the book.
+*/
+int
+book_probe(board_t *board, int player, move_t *best_move, int *cost) {
+    // binary search for the board's first entry
+    uint64_t low = 0, high = opening_book.num_entries;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (opening_book.entries[mid].hash < board->hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    // the best of its actions that are valid (boards may share a hash)
+    move_t moves[MAX_MOVES];
+    int num_moves = get_valid_actions(board, player, moves);
+    int best_weight = 0;
+    for (uint64_t i=low; i<opening_book.num_entries
+        && opening_book.entries[i].hash == board->hash; i++) {
+        book_entry_t *entry = &opening_book.entries[i];
+        for (int j=0; j<num_moves; j++) {
+            if (moves[j] == entry->move && entry->weight > best_weight) {
+                best_weight = entry->weight;
+                *best_move = entry->move;
+                *cost = entry->cost;
+            }
+        }
+    }
+    return best_weight > 0;
+}
+
+/* Builds an opening book of the first plies (default BOOK_PLIES) of games
+    and writes it to the given file. The actions of the given game files are
+    added as played; without files, the book is built by self-play: for each
+    player, the searched action of every board reached when the opponent
+    tries all its actions.
+*/
+int
+run_book(options_t *options) {
+    if (options->num_args < 1) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    book_builder_t builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.max_plies = options->num_args > 1 ? atoi(options->args[1])
+        : BOOK_PLIES;
+    builder.options = options;
+    if (builder.max_plies < 1) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    double start_ms = now_ms();
+
+    if (options->num_args > 2) {
+        for (int i=2; i<options->num_args; i++) {
+            FILE *stream = fopen(options->args[i], "r");
+            if (!stream) {
+                perror(options->args[i]);
+                free(builder.entries);
+                return EXIT_FAILURE;
+            }
+            input_t *input = (input_t*)malloc(sizeof(input_t));
+            assert(input!=NULL);
+            init_input(input, stream, FALSE);
+            board_t board;
+            fill_initial_board(&board);
+            action_t action;
+            char command;
+            for (int turn=1; turn<=builder.max_plies && get_action(input,
+                action, &command) == PARSE_ACTION && is_action_legal(&board,
+                action, turn%NUM_PLAYERS, FALSE); turn++) {
+                uint64_t hash = board.hash;
+                do_action(&board, action, turn%NUM_PLAYERS);
+                book_add(&builder, hash, action_to_move(action),
+                    calculate_cost(&board));
+            }
+            free(input);
+            fclose(stream);
+        }
+    } else {
+        for (int engine=0; engine<NUM_PLAYERS; engine++) {
+            board_t board;
+            fill_initial_board(&board);
+            builder.engine = engine;
+            book_self_play(&builder, &board, BLACK, 1);
+        }
+    }
+
+    // sort the entries and merge the same actions of the same boards
+    qsort(builder.entries, builder.num_entries, sizeof(book_entry_t),
+        compare_book_entries);
+    uint64_t num_entries = 0;
+    for (uint64_t i=0; i<builder.num_entries; i++) {
+        book_entry_t *last = builder.entries + num_entries - (num_entries > 0);
+        if (num_entries && last->hash == builder.entries[i].hash
+            && last->move == builder.entries[i].move) {
+            if (last->weight < UINT16_MAX) {
+                last->weight++;
+            }
+        } else {
+            builder.entries[num_entries++] = builder.entries[i];
+        }
+    }
+
+    FILE *stream = fopen(options->args[0], "wb");
+    if (!stream) {
+        perror(options->args[0]);
+        free(builder.entries);
+        return EXIT_FAILURE;
+    }
+    book_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_MAGIC, RECORD_MAGIC_LEN);
+    header.version = BOOK_VERSION;
+    header.num_entries = num_entries;
+    fwrite(&header, sizeof(header), 1, stream);
+    fwrite(builder.entries, sizeof(book_entry_t), num_entries, stream);
+    int is_ok = !ferror(stream);
+    is_ok &= fclose(stream) == 0;
+    free(builder.entries);
+    if (!is_ok) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+    printf("{\"plies\": %d, \"actions\": %llu, \"entries\": %llu, "
+        "\"bytes\": %llu, \"time_ms\": %.3f}\n", builder.max_plies,
+        (unsigned long long)builder.num_entries,
+        (unsigned long long)num_entries, (unsigned long long)(sizeof(header)
+            + num_entries * sizeof(book_entry_t)), now_ms() - start_ms);
+    return EXIT_SUCCESS;
+}
+
+/* Adds the searched action of the `board` to the book if `player` is the
+    builder's engine and continues with it, or continues with every action of
+    the opponent, until the book's number of plies.
+*/
+void
+book_self_play(book_builder_t *builder, board_t *board, int player,
+    int ply) {
+    if (ply > builder->max_plies) {
+        return;
+    }
+    move_t moves[MAX_MOVES];
+    int num_moves;
+    if (player == builder->engine) {
+        node_t *best_action = iterative_deepening(board, player,
+            builder->options, NULL, NULL);
+        int cost = best_action->cost;
+        moves[0] = action_to_move(best_action->action);
+        free(best_action);
+        if (cost == INT_MAX || cost == INT_MIN) {
+            return;     // the game is over
+        }
+        num_moves = 1;
+        book_add(builder, board->hash, moves[0], cost);
+    } else {
+        num_moves = get_valid_actions(board, player, moves);
+    }
+    for (int i=0; i<num_moves; i++) {
+        undo_t undo;
+        make_move(board, moves[i], player, &undo);
+        book_self_play(builder, board, !player, ply + 1);
+        unmake_move(board, moves[i], player, &undo);
+    }
+}
+
+/* Appends an entry for `move` on the board with hash `hash` to the builder.
+*/
+void
+book_add(book_builder_t *builder, uint64_t hash, move_t move, int cost) {
+    if (builder->num_entries == builder->capacity) {
+        builder->capacity = builder->capacity ? 2 * builder->capacity : 1024;
+        builder->entries = (book_entry_t*)realloc(builder->entries,
+            builder->capacity * sizeof(book_entry_t));
+        assert(builder->entries!=NULL);
+    }
+    book_entry_t *entry = &builder->entries[builder->num_entries++];
+    memset(entry, 0, sizeof(book_entry_t));
+    entry->hash = hash;
+    entry->move = move;
+    entry->weight = 1;
+    entry->cost = cost;
+}
+
+/* Orders book entries by hash, then action (for qsort).
+*/
+int
+compare_book_entries(const void *a, const void *b) {
+    const book_entry_t *entry_a = a, *entry_b = b;
+    if (entry_a->hash != entry_b->hash) {
+        return entry_a->hash < entry_b->hash ? -1 : 1;
+    }
+    return (int)entry_a->move - (int)entry_b->move;
+}
+
+/* --------------------------- Command Functions ---------------------------- */
+
+/* Runs the command given on the command line. Returns the exit status.
+*/
+int
+run_command(options_t *options) {
+    if (strcmp(options->command, CMD_SCALING) == 0) {
+        return run_scaling_report(options);
+    } else if (strcmp(options->command, CMD_PERFT) == 0) {
+        return run_perft(options);
+    } else if (strcmp(options->command, CMD_BENCH) == 0) {
+        return run_bench(options);
+    } else if (strcmp(options->command, CMD_BATCH) == 0) {
+        return run_batch(options);
+    } else if (strcmp(options->command, CMD_ENCODE) == 0) {
+        return run_encode(options);
+    } else if (strcmp(options->command, CMD_DECODE) == 0) {
+        return run_decode(options);
+    } else if (strcmp(options->command, CMD_ENDGAME) == 0) {
+        return run_endgame(options);
+    } else if (strcmp(options->command, CMD_BOOK) == 0) {
+        return run_book(options);
+    } else if (strcmp(options->command, CMD_SERVE) == 0) {
+        return run_serve(options);
+    } else if (strcmp(options->command, CMD_TOURNAMENT) == 0) {
+        return run_tournament(options);
+    }
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+}
+
+/* Searches the initial board to a fixed depth with 1 up to `options->threads`
+    threads, and prints the nodes per second and speedup of each.
+*/
+int
+run_scaling_report(options_t *options) {
+    int depth = options->num_args ? atoi(options->args[0]) : SCALING_DEPTH;
+    if (depth < 1 || depth > MAX_DEPTH) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    board_t board;
+    fill_initial_board(&board);
+
+    options_t thread_options = *options;
+    thread_options.depth = depth;
+    thread_options.time_ms = 0;
+    thread_options.max_nodes = 0;
+    double base_ms = 0;
+    for (int threads=1; threads<=options->threads; threads++) {
+        thread_options.threads = threads;
+        tt_clear();
+        uint64_t nodes = search_stats.nodes;
+        double start_ms = now_ms();
+        node_t *best_action = iterative_deepening(&board, BLACK,
+            &thread_options, NULL, NULL);
+        double time_ms = now_ms() - start_ms;
+        nodes = search_stats.nodes - nodes;
+        if (threads == 1) {
+            base_ms = time_ms;
+        }
+        action_t action;
+        strcpy(action, best_action->action);
+        printf("THREADS: %d, DEPTH: %d, ACTION: %c%c-%c%c, NODES: %llu, "
+            "TIME: %.1f ms, NODES/SEC: %.0f, SPEEDUP: %.2f\n", threads,
+            depth, action[SRC_COL], action[SRC_ROW], action[TAR_COL],
+            action[TAR_ROW], (unsigned long long)nodes, time_ms,
+            time_ms > 0 ? nodes / time_ms * 1000 : 0.0,
+            time_ms > 0 ? base_ms / time_ms : 0.0);
+        free(best_action);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Counts the leaf nodes of each depth up to the given depth, from the initial
+    board or the board after the actions in each of the given files, and
+    prints one JSON object per depth, followed by a summary with the totals
+    (and whether the search is specialized for each colour, to compare builds
+    with -DNO_SPECIALIZATION). Where the hardware counters can be read, the
+    branches mispredicted while counting are included.
+*/
+int
+run_perft(options_t *options) {
+    int depth = options->num_args ? atoi(options->args[0]) : 0;
+    if (depth < 1 || depth > MAX_DEPTH) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    int num_files = options->num_args - 1;
+    int num_positions = num_files ? num_files : 1;
+    int counter = open_branch_counter();
+    uint64_t total_nodes = 0, total_misses = 0;
+    double total_ms = 0;
+    for (int i=0; i<num_positions; i++) {
+        board_t board;
+        int turn = 1;
+        char command;
+        char *file = num_files ? options->args[i+1] : NULL;
+        if (!file) {
+            fill_initial_board(&board);
+        } else if (replay_game(file, &board, &turn, &command)
+            == REPLAY_ERROR) {
+            perror(file);
+            return EXIT_FAILURE;
+        }
+
+        for (int d=1; d<=depth; d++) {
+            uint64_t misses = read_branch_counter(counter);
+            double start_ms = now_ms();
+            uint64_t nodes = perft(&board, turn%NUM_PLAYERS, d);
+            double time_ms = now_ms() - start_ms;
+            misses = read_branch_counter(counter) - misses;
+            total_nodes += nodes;
+            total_misses += misses;
+            total_ms += time_ms;
+            if (file) {
+                printf("{\"position\": \"%s\", ", file);
+            } else {
+                printf("{");
+            }
+            printf("\"depth\": %d, \"nodes\": %llu, \"time_ms\": %.3f, "
+                "\"nodes_per_sec\": %.0f", d, (unsigned long long)nodes,
+                time_ms, time_ms > 0 ? nodes / time_ms * 1000 : 0.0);
+            if (counter >= 0) {
+                printf(", \"branch_misses\": %llu, \"misses_per_node\": %.3f",
+                    (unsigned long long)misses, (double)misses / nodes);
+            }
+            printf("}\n");
+        }
+    }
+
+#ifdef NO_SPECIALIZATION
+    int is_specialized = FALSE;
+#else
+    int is_specialized = TRUE;
+#endif
+    printf("{\"positions\": %d, \"depth\": %d, \"specialized\": %s, "
+        "\"nodes\": %llu, \"time_ms\": %.3f, \"nodes_per_sec\": %.0f",
+        num_positions, depth, is_specialized ? "true" : "false",
+        (unsigned long long)total_nodes, total_ms,
+        total_ms > 0 ? total_nodes / total_ms * 1000 : 0.0);
+    if (counter >= 0) {
+        printf(", \"branch_misses\": %llu, \"misses_per_node\": %.3f",
+            (unsigned long long)total_misses,
+            (double)total_misses / total_nodes);
+        close(counter);
+    }
+    printf("}\n");
+    return EXIT_SUCCESS;
+}
+
+/* Starts counting the branches this thread mispredicts (in user space) with
+    the hardware counters. Returns the counter, or -1 if they cannot be read
+    (not on Linux, or not allowed in this environment).
+*/
+int
+open_branch_counter(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/* Returns the number of branches mispredicted so far on the `counter` (0
+    without one).
+*/
+uint64_t
+read_branch_counter(int counter) {
+    uint64_t misses = 0;
+    if (counter >= 0 && read(counter, &misses, sizeof(misses))
+        != sizeof(misses)) {
+        misses = 0;
+    }
+    return misses;
+}
+
+/* Returns the number of boards reached after `depth` actions from `board`
+    (see perft_node), with the copy specialized for `player`.
+*/
+SPECIALIZED uint64_t
+perft(board_t *board, int player, int depth) {
+    if (player == BLACK) {
+        return perft_black(board, depth);
+    }
+    return perft_white(board, depth);
+}
+
+/* Counts the boards with black to move.
+*/
+uint64_t
+perft_black(board_t *board, int depth) {
+    return perft_node(board, BLACK, depth);
+}
+
+/* Counts the boards with white to move.
+*/
+uint64_t
+perft_white(board_t *board, int depth) {
+    return perft_node(board, WHITE, depth);
+}
+
+/* Returns the number of boards reached after `depth` actions from `board`.
+    Only inlined into perft_black and perft_white.
+*/
+SPECIALIZED uint64_t
+perft_node(board_t *board, int player, int depth) {
+    move_t moves[MAX_MOVES];
+    int num_moves = generate_actions(board, player, moves, FALSE);
+    if (depth == 1) {
+        return num_moves;
+    }
+    uint64_t nodes = 0;
+    for (int i=0; i<num_moves; i++) {
+        undo_t undo;
+        make_move(board, moves[i], player, &undo);
+        nodes += perft(board, !player, depth-1);
+        unmake_move(board, moves[i], player, &undo);
+    }
+    return nodes;
+}
+
+/* Searches the board after the actions of each benchmark file (the testcases
+    by default) to a fixed depth, and prints one JSON object per position and
+    a summary with the total nodes per second and memory use.
+*/
+int
+run_bench(options_t *options) {
+    int depth = options->num_args ? atoi(options->args[0]) : BENCH_DEPTH;
+    if (depth < 1 || depth > MAX_DEPTH) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    char *default_files[NUM_BENCH_FILES] = BENCH_FILES;
+    char **files = default_files;
+    int num_files = NUM_BENCH_FILES;
+    if (options->num_args > 1) {
+        files = options->args + 1;
+        num_files = options->num_args - 1;
+    }
+
+    options_t bench_options = *options;
+    bench_options.depth = depth;
+    bench_options.time_ms = 0;
+    bench_options.max_nodes = 0;
+    uint64_t total_nodes = 0, total_qnodes = 0;
+    double total_ms = 0;
+    for (int i=0; i<num_files; i++) {
+        board_t board;
+        int turn = 1;
+        char command;
+        if (replay_game(files[i], &board, &turn, &command) == REPLAY_ERROR) {
+            perror(files[i]);
+            return EXIT_FAILURE;
+        }
+
+        // every position starts with an empty transposition table
+        tt_clear();
+        search_info_t info;
+        node_t *best_action = iterative_deepening(&board, turn%NUM_PLAYERS,
+            &bench_options, NULL, &info);
+        total_nodes += info.stats.nodes;
+        total_qnodes += info.stats.qnodes;
+        total_ms += info.time_ms;
+
+        printf("{\"position\": \"%s\", \"turn\": %d, \"depth\": %d, "
+            "\"action\": \"%s\", \"cost\": %d, \"nodes\": %llu, "
+            "\"qnodes\": %llu, \"time_ms\": %.3f, \"nodes_per_sec\": %.0f, "
+            "\"depth_ms\": [", files[i], turn, info.depth,
+            best_action->action, best_action->cost,
+            (unsigned long long)info.stats.nodes,
+            (unsigned long long)info.stats.qnodes, info.time_ms,
+            info.time_ms > 0 ? info.stats.nodes / info.time_ms * 1000 : 0.0);
+        for (int d=1; d<=info.depth; d++) {
+            printf("%s%.3f", d > 1 ? ", " : "", info.depth_ms[d]);
+        }
+        printf("]}\n");
+        free(best_action);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"positions\": %d, \"depth\": %d, \"threads\": %d, "
+        "\"nodes\": %llu, \"qnodes\": %llu, \"time_ms\": %.3f, "
+        "\"nodes_per_sec\": %.0f, \"hash_kb\": %llu, \"max_rss_kb\": %ld}\n",
+        num_files, depth, options->threads, (unsigned long long)total_nodes,
+        (unsigned long long)total_qnodes, total_ms,
+        total_ms > 0 ? total_nodes / total_ms * 1000 : 0.0,
+        (unsigned long long)((trans_table.mask + 1) * BUCKET_SIZE
+            * sizeof(tt_slot_t) / 1024), usage.ru_maxrss);
+    return EXIT_SUCCESS;
+}
+
+/* Sets up the initial board and performs the actions in the file at `path`,
+    stopping at its command or first illegal action. `turn` is left at the
+    turn of the next action. Returns REPLAY_ERROR if the file cannot be
+    opened, REPLAY_ILLEGAL if a line is not a legal action and REPLAY_OK
+    otherwise.
+*/
+int
+replay_game(char *path, board_t *board, int *turn, char *command) {
+    fill_initial_board(board);
+    *command = DASH;
+    FILE *stream = fopen(path, "r");
+    if (!stream) {
+        return REPLAY_ERROR;
+    }
+    input_t *input = (input_t*)malloc(sizeof(input_t));
+    assert(input!=NULL);
+    init_input(input, stream, FALSE);
+    action_t action;
+    int parsed, status = REPLAY_OK;
+    while ((parsed = get_action(input, action, command)) != PARSE_END
+        && parsed != PARSE_COMMAND) {
+        if (parsed == PARSE_ERROR
+            || !is_action_legal(board, action, *turn%NUM_PLAYERS, FALSE)) {
+            status = REPLAY_ILLEGAL;
+            break;
+        }
+        do_action(board, action, *turn%NUM_PLAYERS);
+        (*turn)++;
+    }
+    free(input);
+    fclose(stream);
+    return status;
+}
+
+/* Replays and analyses every game in a directory (its .txt files) or listed
+    in a manifest (one path per line), `options->threads` games at a time,
+    and prints one JSON object per game in the listed order and a summary.
+*/
+int
+run_batch(options_t *options) {
+    if (options->num_args != 1) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    char **paths;
+    int num_games = read_game_list(options->args[0], &paths);
+    if (num_games < 0) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+
+    // every game is searched by a single thread
+    options_t game_options = *options;
+    game_options.threads = 1;
+    batch_t batch;
+    batch.records = (game_record_t*)malloc(num_games * sizeof(game_record_t)
+        + 1);
+    assert(batch.records!=NULL);
+    batch.num_records = num_games;
+    batch.options = &game_options;
+    atomic_init(&batch.next, 0);
+    for (int i=0; i<num_games; i++) {
+        batch.records[i].path = paths[i];
+    }
+
+    pthread_t threads[MAX_THREADS];
+    double start_ms = now_ms();
+    for (int i=1; i<options->threads; i++) {
+        int error = pthread_create(&threads[i], NULL, batch_worker, &batch);
+        assert(!error);
+    }
+    batch_worker(&batch);
+    for (int i=1; i<options->threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double time_ms = now_ms() - start_ms;
+
+    int num_status[REPLAY_OK-REPLAY_ERROR+1] = {0};
+    uint64_t nodes = 0;
+    for (int i=0; i<num_games; i++) {
+        print_record(stdout, &batch.records[i]);
+        num_status[batch.records[i].status-REPLAY_ERROR]++;
+        nodes += batch.records[i].nodes;
+        free(paths[i]);
+    }
+    printf("{\"games\": %d, \"ok\": %d, \"illegal\": %d, \"errors\": %d, "
+        "\"threads\": %d, \"nodes\": %llu, \"time_ms\": %.3f, "
+        "\"games_per_sec\": %.1f}\n", num_games,
+        num_status[REPLAY_OK-REPLAY_ERROR],
+        num_status[REPLAY_ILLEGAL-REPLAY_ERROR],
+        num_status[REPLAY_ERROR-REPLAY_ERROR], options->threads,
+        (unsigned long long)nodes, time_ms,
+        time_ms > 0 ? num_games / time_ms * 1000 : 0.0);
+    free(paths);
+    free(batch.records);
+    return EXIT_SUCCESS;
+}
+
+/* Stores the paths of the games in the directory or manifest at `path` in a
+    new array at `paths`. Directory entries are sorted by name.
+    Returns the number of games, or -1 if `path` cannot be read.
+*/
+int
+read_game_list(char *path, char ***paths) {
+    int num_paths = 0, capacity = 1;
+    *paths = (char**)malloc(capacity * sizeof(char*));
+    assert(*paths!=NULL);
+    char line[MAX_PATH_LEN];
+
+    DIR *dir = opendir(path);
+    FILE *manifest = dir ? NULL : fopen(path, "r");
+    if (!dir && !manifest) {
+        free(*paths);
+        return -1;
+    }
+    while (TRUE) {
+        if (dir) {
+            struct dirent *entry = readdir(dir);
+            if (!entry) {
+                break;
+            }
+            size_t len = strlen(entry->d_name);
+            if (len < strlen(GAME_EXT) || strcmp(entry->d_name + len
+                - strlen(GAME_EXT), GAME_EXT) != 0 || (len >= strlen(
+                GAME_OUT_EXT) && strcmp(entry->d_name + len
+                - strlen(GAME_OUT_EXT), GAME_OUT_EXT) == 0)) {
+                continue;   // not a game
+            }
+            snprintf(line, MAX_PATH_LEN, "%s/%s", path, entry->d_name);
+        } else {
+            if (!fgets(line, MAX_PATH_LEN, manifest)) {
+                break;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0') {
+                continue;   // skip blank lines
+            }
+        }
+        if (num_paths == capacity) {
+            capacity *= 2;
+            *paths = (char**)realloc(*paths, capacity * sizeof(char*));
+            assert(*paths!=NULL);
+        }
+        (*paths)[num_paths] = strdup(line);
+        assert((*paths)[num_paths]!=NULL);
+        num_paths++;
+    }
+
+    if (dir) {
+        closedir(dir);
+        qsort(*paths, num_paths, sizeof(char*), compare_paths);
+    } else {
+        fclose(manifest);
+    }
+    return num_paths;
+}
+
+/* Orders two paths alphabetically (for qsort).
+*/
+int
+compare_paths(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Analyses the games of the batch `arg` until none are left.
+*/
+void
+*batch_worker(void *arg) {
+    batch_t *batch = (batch_t*)arg;
+    int index;
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->num_records) {
+        analyse_game(&batch->records[index], batch->options);
+    }
+    return NULL;
+}
+
+/* Replays the game of `record` and computes the actions of its command,
+    like mode 2 but storing the results in `record` instead of printing them.
+*/
+void
+analyse_game(game_record_t *record, options_t *options) {
+    board_t board;
+    int turn = 1;
+    record->status = replay_game(record->path, &board, &turn,
+        &record->command);
+    record->plies = turn - 1;
+    record->num_actions = 0;
+    record->winner = NO_WINNER;
+    record->cost = calculate_cost(&board);
+    record->nodes = 0;
+    record->time_ms = 0;
+    if (record->status != REPLAY_OK) {
+        return;
+    }
+
+    int comp_actions = 0;
+    if (record->command == A_COMMAND) {
+        comp_actions = A_COMP_ACTIONS;
+    } else if (record->command == P_COMMAND) {
+        comp_actions = P_COMP_ACTIONS;
+    }
+    search_memory_t memory;
+    memset(&memory, 0, sizeof(memory));
+    for (int i=0; i<comp_actions; i++) {
+        search_info_t info;
+        node_t *best_action = iterative_deepening(&board, turn%NUM_PLAYERS,
+            options, &memory, &info);
+        record->nodes += info.stats.nodes;
+        record->time_ms += info.time_ms;
+        record->cost = best_action->cost;
+        if (best_action->cost == INT_MAX || best_action->cost == INT_MIN) {
+            record->winner = best_action->cost == INT_MAX ? BLACK : WHITE;
+            free(best_action);
+            break;
+        }
+        do_action(&board, best_action->action, turn%NUM_PLAYERS);
+        strcpy(record->actions[record->num_actions++], best_action->action);
+        free(best_action);
+        turn++;
+    }
+}
+
+/* Prints `record` to `stream` as one JSON object.
+*/
+void
+print_record(FILE *stream, game_record_t *record) {
+    static const char *status_names[] = {"error", "illegal", "ok"};
+    fprintf(stream, "{\"game\": \"%s\", \"status\": \"%s\", "
+        "\"plies\": %d, \"command\": ", record->path,
+        status_names[record->status-REPLAY_ERROR], record->plies);
+    if (record->command == DASH) {
+        fprintf(stream, "null");
+    } else {
+        fprintf(stream, "\"%c\"", record->command);
+    }
+    fprintf(stream, ", \"actions\": [");
+    for (int i=0; i<record->num_actions; i++) {
+        char *action = record->actions[i];
+        fprintf(stream, "%s\"%c%c-%c%c\"", i ? ", " : "", action[0],
+            action[1], action[2], action[3]);
+    }
+    fprintf(stream, "], \"winner\": %s, \"cost\": %d, \"nodes\": %llu, "
+        "\"time_ms\": %.3f}\n", record->winner == NO_WINNER ? "null"
+        : record->winner == BLACK ? "\"black\"" : "\"white\"", record->cost,
+        (unsigned long long)record->nodes, record->time_ms);
+}
+
+/* Converts the action lists in the given files into games of a new binary
+    record, and prints a JSON summary. Games stop at their first invalid or
+    illegal action, which is reported.
+*/
+int
+run_encode(options_t *options) {
+    if (options->num_args < 2) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    record_writer_t writer;
+    if (!open_record_writer(&writer, options->args[0], options->record_flags)) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+    int num_games = options->num_args - 1, num_illegal = 0;
+    uint64_t total_plies = 0;
+    for (int i=1; i<options->num_args; i++) {
+        int plies;
+        int status = encode_game(options->args[i], &writer, &plies);
+        if (status == REPLAY_ERROR) {
+            perror(options->args[i]);
+            close_record_writer(&writer);
+            return EXIT_FAILURE;
+        } else if (status == REPLAY_ILLEGAL) {
+            fprintf(stderr, "%s: stopped at action #%d\n", options->args[i],
+                plies + 1);
+            num_illegal++;
+        }
+        total_plies += plies;
+    }
+    long bytes = ftell(writer.stream);
+    if (!close_record_writer(&writer)) {
+        perror(options->args[0]);
+        return EXIT_FAILURE;
+    }
+    printf("{\"games\": %d, \"illegal\": %d, \"plies\": %llu, "
+        "\"bytes\": %ld}\n", num_games, num_illegal,
+        (unsigned long long)total_plies, bytes);
+    return EXIT_SUCCESS;
+}
+
+/* Appends the game in the action list at `path` to the record of `writer`
+    and stores its number of legal actions in `plies`. Returns like
+    replay_game.
+*/
+int
+encode_game(char *path, record_writer_t *writer, int *plies) {
+    *plies = 0;
+    FILE *stream = fopen(path, "r");
+    if (!stream) {
+        return REPLAY_ERROR;
+    }
+    input_t *input = (input_t*)malloc(sizeof(input_t));
+    assert(input!=NULL);
+    init_input(input, stream, FALSE);
+    board_t board;
+    fill_initial_board(&board);
+    action_t action;
+    char command = DASH;
+    int parsed, status = REPLAY_OK;
+    while ((parsed = get_action(input, action, &command)) != PARSE_END
+        && parsed != PARSE_COMMAND) {
+        int player = (*plies + 1) % NUM_PLAYERS;
+        if (parsed == PARSE_ERROR
+            || !is_action_legal(&board, action, player, FALSE)) {
+            status = REPLAY_ILLEGAL;
+            break;
+        }
+        do_action(&board, action, player);
+        write_ply(writer, action_to_move(action), &board, FALSE);
+        (*plies)++;
+    }
+    end_game_record(writer, command);
+    free(input);
+    fclose(stream);
+    return status;
+}
+
+/* Converts the games of a binary record back into action lists (without
+    their computed actions), printed to stdout one after another or written
+    to one file per game in the given directory.
+*/
+int
+run_decode(options_t *options) {
+    if (options->num_args < 1 || options->num_args > 2) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    record_reader_t reader;
+    if (!open_record_reader(&reader, options->args[0])) {
+        fprintf(stderr, "%s: not a binary game record\n", options->args[0]);
+        return EXIT_FAILURE;
+    }
+    char *dir = options->num_args > 1 ? options->args[1] : NULL;
+    char path[MAX_PATH_LEN];
+    unsigned long long num_games = 0;
+    FILE *stream = NULL;
+    move_t move;
+    int status;
+    while ((status = read_ply(&reader, &move)) > PLY_EOF) {
+        if (!stream) {  // the game's first ply
+            stream = stdout;
+            if (dir) {
+                snprintf(path, MAX_PATH_LEN, GAME_FILE_FORMAT, dir, num_games);
+                if (!(stream = fopen(path, "w"))) {
+                    perror(path);
+                    close_record_reader(&reader);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        if (status == PLY_MOVE && !reader.computed) {
+            action_t action;
+            move_to_action(move, action);
+            fprintf(stream, "%c%c-%c%c\n", action[SRC_COL], action[SRC_ROW],
+                action[TAR_COL], action[TAR_ROW]);
+        } else if (status == PLY_GAME_END) {
+            if (reader.command != DASH) {
+                fprintf(stream, "%c\n", reader.command);
+            }
+            if (stream != stdout) {
+                fclose(stream);
+            }
+            stream = NULL;
+            num_games++;
+        }
+    }
+    close_record_reader(&reader);
+    if (status == PLY_ERROR) {
+        fprintf(stderr, "%s: damaged or illegal ply in game %llu\n",
+            options->args[0], num_games + 1);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* ------------------------- Engine Server Functions ------------------------ */
+/* Serves engine requests on stdin and stdout, or on connections to a unix
+    socket at the path in the arguments, until the input ends (or, with a
+    socket, for good). Sessions and the transposition table are shared by
+    every connection, and the searches of all sessions run on a pool of
+    `options->threads` threads, one thread per search.
+*/
+int
+run_serve(options_t *options) {
+    if (options->num_args > 1) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    static server_t server;
+    options_t search_options = *options;
+    search_options.threads = 1;
+    server.num_sessions = server.queue_head = server.num_queued = 0;
+    server.is_closing = FALSE;
+    server.options = &search_options;
+    server.num_threads = options->threads;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.changed, NULL);
+    for (int i=0; i<options->threads; i++) {
+        int error = pthread_create(&server.threads[i], NULL, server_worker,
+            &server);
+        assert(!error);
+    }
+
+    if (options->num_args == 0) {
+        static connection_t connection;
+        connection.in = stdin;
+        connection.out = stdout;
+        connection.server = &server;
+        connection.num_searching = 0;
+        pthread_mutex_init(&connection.lock, NULL);
+        serve_connection(&server, &connection);
+    } else {
+        // a client closing its connection must not end the server
+        signal(SIGPIPE, SIG_IGN);
+        char *path = options->args[0];
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+        unlink(path);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr*)&address,
+            sizeof(address)) < 0 || listen(listener, SERVER_BACKLOG) < 0) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        while (TRUE) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            connection_t *connection = (connection_t*)malloc(
+                sizeof(connection_t));
+            assert(connection!=NULL);
+            connection->in = fdopen(fd, "r");
+            connection->out = fdopen(dup(fd), "w");
+            connection->server = &server;
+            connection->num_searching = 0;
+            pthread_mutex_init(&connection->lock, NULL);
+            pthread_t thread;
+            int error = pthread_create(&thread, NULL, connection_worker,
+                connection);
+            assert(!error);
+            pthread_detach(thread);
+        }
+    }
+
+    // end the pool once every search is done
+    pthread_mutex_lock(&server.lock);
+    server.is_closing = TRUE;
+    pthread_cond_broadcast(&server.changed);
+    pthread_mutex_unlock(&server.lock);
+    for (int i=0; i<options->threads; i++) {
+        pthread_join(server.threads[i], NULL);
+    }
+    pthread_mutex_lock(&server.lock);
+    while (server.num_sessions) {
+        close_session(&server, server.sessions[0]);
+    }
+    pthread_mutex_unlock(&server.lock);
+    return EXIT_SUCCESS;
+}
+
+/* Serves the socket connection `arg`, then closes it.
+*/
+void
+*connection_worker(void *arg) {
+    connection_t *connection = (connection_t*)arg;
+    serve_connection((server_t*)connection->server, connection);
+    fclose(connection->in);
+    fclose(connection->out);
+    pthread_mutex_destroy(&connection->lock);
+    free(connection);
+    return NULL;
+}
+
+/* Answers the requests of the connection until its input ends or it asks to
+    quit, then waits for the searches it started.
+*/
+void
+serve_connection(server_t *server, connection_t *connection) {
+    while (fgets(connection->line, SERVER_LINE_LEN, connection->in)) {
+        size_t len = strlen(connection->line);
+        if (len == SERVER_LINE_LEN - 1
+            && connection->line[len-1] != NEWLINE_CHAR) {
+            // skip the rest of a request that is too long
+            int c;
+            while ((c = fgetc(connection->in)) != EOF && c != NEWLINE_CHAR);
+            send_reply(connection, "error request too long\n");
+            continue;
+        }
+        char *name = connection->line;
+        name += strspn(name, TOKEN_DELIMITERS);
+        if (strncmp(name, REQ_QUIT, strlen(REQ_QUIT)) == 0
+            && strchr(TOKEN_DELIMITERS, name[strlen(REQ_QUIT)])) {
+            break;
+        }
+        serve_request(server, connection, connection->line);
+    }
+
+    // replies of the searches still running go to this connection
+    pthread_mutex_lock(&server->lock);
+    while (connection->num_searching) {
+        pthread_cond_wait(&server->changed, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* Answers one request `line` of the connection. Every request is answered by
+    one line starting with its session name, except go, which is answered
+    once its search ends, and stop, which only makes that happen sooner.
+    The whole request is handled under the server's lock, as another
+    connection may close the session, and its reply is sent once the lock
+    is released.
+*/
+void
+serve_request(server_t *server, connection_t *connection, char *line) {
+    char *rest;
+    char *name = strtok_r(line, TOKEN_DELIMITERS, &rest);
+    char *request = strtok_r(NULL, TOKEN_DELIMITERS, &rest);
+    if (!name) {
+        return;     // empty line
+    }
+    if (!request || strlen(name) > SESSION_NAME_LEN) {
+        send_reply(connection, "error expected \"session request [args]\"\n");
+        return;
+    }
+    int is_new_game = strcmp(request, REQ_STOP) != 0
+        && strcmp(request, REQ_CLOSE) != 0;
+    char *reply = connection->reply;
+    size_t size = sizeof(connection->reply);
+    reply[0] = '\0';
+    pthread_mutex_lock(&server->lock);
+    session_t *session = find_session(server, name, is_new_game);
+    if (!session) {
+        snprintf(reply, size, "%s error %s\n", name, is_new_game ?
+            "too many sessions" : "no such session");
+    } else if (strcmp(request, REQ_STOP) == 0) {
+        atomic_store(&session->stop, TRUE);
+    } else if (strcmp(request, REQ_STATS) == 0) {
+        pthread_mutex_lock(&search_stats_lock);
+        search_stats_t stats = search_stats;
+        pthread_mutex_unlock(&search_stats_lock);
+        snprintf(reply, size, "%s stats {\"searches\": %llu, \"nodes\": "
+            "%llu, \"time_ms\": %.3f, \"sessions\": %d, \"threads\": %d, "
+            "\"server_searches\": %llu, \"server_nodes\": %llu, "
+            "\"tt_hit_rate\": %.3f}\n", name,
+            (unsigned long long)session->searches,
+            (unsigned long long)session->nodes, session->time_ms,
+            server->num_sessions, server->num_threads,
+            (unsigned long long)stats.searches,
+            (unsigned long long)stats.nodes, stats.tt_probes ?
+                (double)stats.tt_hits / stats.tt_probes : 0.0);
+    } else if (session->is_searching) {
+        // the other requests change the session
+        snprintf(reply, size, "%s error busy\n", name);
+    } else if (strcmp(request, REQ_CLOSE) == 0) {
+        close_session(server, session);
+        snprintf(reply, size, "%s ok\n", name);
+    } else if (strcmp(request, REQ_SET_POSITION) == 0) {
+        char *cells = strtok_r(NULL, TOKEN_DELIMITERS, &rest);
+        char *side = strtok_r(NULL, TOKEN_DELIMITERS, &rest);
+        if (cells && parse_position(cells, side, &session->board,
+            &session->player)) {
+            snprintf(reply, size, "%s ok\n", name);
+        } else {
+            snprintf(reply, size, "%s error bad position\n", name);
+        }
+    } else if (strcmp(request, REQ_APPLY_MOVES) == 0) {
+        char *token;
+        int is_legal = TRUE;
+        while (is_legal && (token = strtok_r(NULL, TOKEN_DELIMITERS, &rest))) {
+            is_legal = apply_move(session, token);
+        }
+        if (is_legal) {
+            snprintf(reply, size, "%s ok\n", name);
+        } else {    // the actions before it stay done
+            snprintf(reply, size, "%s error illegal action %s\n", name,
+                token);
+        }
+    } else if (strcmp(request, REQ_GO) == 0) {
+        session->options = *server->options;
+        if (parse_limits(rest, &session->options)) {
+            session->options.stop = &session->stop;
+            atomic_store(&session->stop, FALSE);
+            session->is_searching = TRUE;
+            session->connection = connection;
+            connection->num_searching++;
+            server->queue[(server->queue_head + server->num_queued)
+                % MAX_SESSIONS] = session;
+            server->num_queued++;
+            pthread_cond_broadcast(&server->changed);
+        } else {
+            snprintf(reply, size, "%s error bad limits\n", name);
+        }
+    } else {
+        snprintf(reply, size, "%s error unknown request %s\n", name,
+            request);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    // a client that does not read its replies must only hold up itself
+    if (reply[0]) {
+        send_reply(connection, "%s", reply);
+    }
+}
+
+/* Returns the session called `name`, made with a new game if `is_creating`
+    and there is none yet. Returns NULL if there is none and it cannot be
+    made. The server's lock must be held.
+*/
+session_t
+*find_session(server_t *server, char *name, int is_creating) {
+    session_t *session = NULL;
+    for (int i=0; i<server->num_sessions && !session; i++) {
+        if (strcmp(server->sessions[i]->name, name) == 0) {
+            session = server->sessions[i];
+        }
+    }
+    if (!session && is_creating && server->num_sessions < MAX_SESSIONS) {
+        session = (session_t*)malloc(sizeof(session_t));
+        assert(session!=NULL);
+        memset(session, 0, sizeof(session_t));
+        strcpy(session->name, name);
+        fill_initial_board(&session->board);
+        session->player = BLACK;
+        atomic_init(&session->stop, FALSE);
+        server->sessions[server->num_sessions++] = session;
+    }
+    return session;
+}
+
+/* Removes the `session` (which must not be searching) from the server. The
+    server's lock must be held.
+*/
+void
+close_session(server_t *server, session_t *session) {
+    for (int i=0; i<server->num_sessions; i++) {
+        if (server->sessions[i] == session) {
+            server->sessions[i] = server->sessions[--server->num_sessions];
+        }
+    }
+    free(session);
+}
+
+/* Does the action `token` (written with or without the dash) for the side to
+    move of the `session`. Returns FALSE if it is not a legal action.
+*/
+int
+apply_move(session_t *session, char *token) {
+    action_t action;
+    size_t len = strlen(token);
+    if (len == ACTION_LEN + 1 && token[ACTION_LEN/2] == DASH) {
+        action[SRC_COL] = token[0];
+        action[SRC_ROW] = token[1];
+        action[TAR_COL] = token[3];
+        action[TAR_ROW] = token[4];
+    } else if (len == ACTION_LEN) {
+        memcpy(action, token, ACTION_LEN);
+    } else {
+        return FALSE;
+    }
+    action[ACTION_LEN] = '\0';
+    if (!is_action_legal(&session->board, action, session->player, FALSE)) {
+        return FALSE;
+    }
+    do_action(&session->board, action, session->player);
+    session->player = !session->player;
+    return TRUE;
+}
+
+/* Sets up `board` and `player` from a set-position request: either "start"
+    for a new game, or the 32 checkered `cells` from A1 onwards (row by row,
+    as characters of the board) and the `side` to move ("b" or "w").
+    Returns FALSE, leaving `board` and `player` as they were, if the position
+    is malformed or cannot be reached: more than MAX_SIDE_PIECES pieces and
+    towers of a player, or a piece on the row it turns into a tower on.
+*/
+int
+parse_position(char *cells, char *side, board_t *board, int *player) {
+    if (strcmp(cells, START_POSITION) == 0) {
+        fill_initial_board(board);
+        *player = BLACK;
+        return TRUE;
+    }
+    if (strlen(cells) != NUM_SQUARES || !side || strlen(side) != 1
+        || (side[0] != CELL_BPIECE && side[0] != CELL_WPIECE)) {
+        return FALSE;
+    }
+    board_t parsed;
+    memset(&parsed, 0, sizeof(board_t));
+    for (int sq=0; sq<NUM_SQUARES; sq++) {
+        switch (cells[sq]) {
+            case CELL_BPIECE: parsed.pieces[BLACK] |= SQUARE_BIT(sq); break;
+            case CELL_WPIECE: parsed.pieces[WHITE] |= SQUARE_BIT(sq); break;
+            case CELL_BTOWER: parsed.towers[BLACK] |= SQUARE_BIT(sq); break;
+            case CELL_WTOWER: parsed.towers[WHITE] |= SQUARE_BIT(sq); break;
+            case CELL_EMPTY: parsed.empty |= SQUARE_BIT(sq); break;
+            default: return FALSE;
+        }
+    }
+    for (int i=0; i<NUM_PLAYERS; i++) {
+        if (count_bits(parsed.pieces[i] | parsed.towers[i]) > MAX_SIDE_PIECES
+            || (parsed.pieces[i] & ROW_BITS(TOWER_ROW[i]))) {
+            return FALSE;
+        }
+    }
+    *player = side[0] == CELL_BPIECE ? BLACK : WHITE;
+    parsed.hash = hash_board(&parsed) ^ (*player == WHITE ? zobrist_side : 0);
+    parsed.cost = count_cost(&parsed);
+    *board = parsed;
+    return TRUE;
+}
+
+/* Reads the "depth N", "time MS" and "nodes N" limits of a go request from
+    `rest` into `options`. Without a depth, a search with a time or node limit
+    goes as deep as they allow. Returns FALSE if a limit is malformed.
+*/
+int
+parse_limits(char *rest, options_t *options) {
+    int depth = 0;
+    char *key;
+    while ((key = strtok_r(NULL, TOKEN_DELIMITERS, &rest))) {
+        char *value = strtok_r(NULL, TOKEN_DELIMITERS, &rest);
+        if (!value) {
+            return FALSE;
+        }
+        if (strcmp(key, GO_DEPTH) == 0) {
+            depth = atoi(value);
+            if (depth < 1 || depth > MAX_DEPTH) {
+                return FALSE;
+            }
+        } else if (strcmp(key, GO_TIME) == 0) {
+            options->time_ms = atol(value);
+            if (options->time_ms < 1) {
+                return FALSE;
+            }
+        } else if (strcmp(key, GO_NODES) == 0) {
+            options->max_nodes = strtoull(value, NULL, 10);
+            if (options->max_nodes < 1) {
+                return FALSE;
+            }
+        } else {
+            return FALSE;
+        }
+    }
+    if (depth) {
+        options->depth = depth;
+    } else if (options->time_ms || options->max_nodes) {
+        options->depth = MAX_DEPTH;
+    }
+    return TRUE;
+}
+
+/* Runs the queued searches of the server `arg` until it closes.
+*/
+void
+*server_worker(void *arg) {
+    server_t *server = (server_t*)arg;
+    pthread_mutex_lock(&server->lock);
+    while (TRUE) {
+        while (!server->num_queued && !server->is_closing) {
+            pthread_cond_wait(&server->changed, &server->lock);
+        }
+        if (!server->num_queued) {
+            break;
+        }
+        session_t *session = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % MAX_SESSIONS;
+        server->num_queued--;
+        pthread_mutex_unlock(&server->lock);
+
+        search_info_t info;
+        char reply[SERVER_REPLY_LEN];
+        serve_search(session, &info, reply);
+
+        // the session takes requests again (and may be closed) by the time
+        // its client has the reply, and the connection stays open until it
+        // is sent, which happens without the lock so that a client that does
+        // not read only holds up this thread
+        pthread_mutex_lock(&server->lock);
+        session->searches++;
+        session->nodes += info.stats.nodes;
+        session->time_ms += info.time_ms;
+        session->is_searching = FALSE;
+        connection_t *connection = session->connection;
+        pthread_mutex_unlock(&server->lock);
+        send_reply(connection, "%s", reply);
+        pthread_mutex_lock(&server->lock);
+        connection->num_searching--;
+        pthread_cond_broadcast(&server->changed);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+/* Searches the board of the `session` and stores the reply with its best
+    action in `reply`, as "name bestmove action cost C depth D nodes N
+    time_ms T", with "none" as the action if the side to move has none. The
+    counters of the search are stored in `info`.
+*/
+void
+serve_search(session_t *session, search_info_t *info, char *reply) {
+    move_t moves[MAX_MOVES];
+    if (!get_valid_actions(&session->board, session->player, moves)) {
+        memset(info, 0, sizeof(search_info_t));
+        snprintf(reply, SERVER_REPLY_LEN, "%s bestmove none cost %d depth 0 "
+            "nodes 0 time_ms 0\n", session->name,
+            session->player == BLACK ? INT_MIN : INT_MAX);
+        return;
+    }
+    node_t *best_action = iterative_deepening(&session->board,
+        session->player, &session->options, &session->memory, info);
+    char *action = best_action->action;
+    snprintf(reply, SERVER_REPLY_LEN, "%s bestmove %c%c-%c%c cost %d depth %d "
+        "nodes %llu time_ms %.3f\n", session->name, action[SRC_COL],
+        action[SRC_ROW], action[TAR_COL], action[TAR_ROW], best_action->cost,
+        info->depth, (unsigned long long)info->stats.nodes, info->time_ms);
+    free(best_action);
+}
+
+/* Writes one reply line to the connection at once, even with other threads
+    replying on it too.
+*/
+void
+send_reply(connection_t *connection, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&connection->lock);
+    vfprintf(connection->out, format, args);
+    fflush(connection->out);
+    pthread_mutex_unlock(&connection->lock);
+    va_end(args);
+}
+
+/* --------------------- Self-Play Tournament Functions --------------------- */
+/* Plays `games` games between engine A and engine B (both the command line
+    options by default) from random openings, each opening twice with the
+    engines swapping sides, `options->threads` games at a time. Prints one
+    JSON object per game and a summary with engine A's wins, draws and
+    losses, its Elo difference with a 95% error margin, the likelihood that
+    it is the stronger engine, and the games per second.
+    An engine is either search options for this process (eg. "-d 6 -q"),
+    the command line's by default, or the command of an engine process
+    answering `serve` requests (eg. "./checkers_old -d 6 serve").
+*/
+int
+run_tournament(options_t *options) {
+    int num_games = options->num_args ? atoi(options->args[0]) : 0;
+    if (num_games < 1 || options->num_args > 3) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    num_games += num_games % 2;     // every opening is played both ways
+    static tournament_t tournament;
+    for (int i=0; i<NUM_PLAYERS; i++) {
+        char *spec = options->num_args > i+1 ? options->args[i+1] : "";
+        if (!open_engine(&tournament.engines[i], spec, options)) {
+            fprintf(stderr, "ERROR: Engine \"%s\" could not be started.\n",
+                spec);
+            return EXIT_FAILURE;
+        }
+    }
+    tournament.games = (match_game_t*)malloc(num_games
+        * sizeof(match_game_t));
+    assert(tournament.games!=NULL);
+    tournament.num_games = num_games;
+    atomic_init(&tournament.next, 0);
+    atomic_init(&tournament.next_slot, 0);
+
+    pthread_t threads[MAX_THREADS];
+    double start_ms = now_ms();
+    for (int i=1; i<options->threads; i++) {
+        int error = pthread_create(&threads[i], NULL, tournament_worker,
+            &tournament);
+        assert(!error);
+    }
+    tournament_worker(&tournament);
+    for (int i=1; i<options->threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double time_ms = now_ms() - start_ms;
+    int has_ended = FALSE;
+    for (int i=0; i<NUM_PLAYERS; i++) {
+        if (tournament.engines[i].has_ended) {
+            fprintf(stderr, "ERROR: Engine \"%s\" stopped replying.\n",
+                tournament.engines[i].spec);
+            has_ended = TRUE;
+        }
+        close_engine(&tournament.engines[i]);
+    }
+    if (has_ended) {
+        free(tournament.games);
+        return EXIT_FAILURE;
+    }
+
+    int counts[3] = {0};
+    for (int i=0; i<num_games; i++) {
+        print_match_game(stdout, i, &tournament.games[i]);
+        counts[tournament.games[i].result]++;
+    }
+
+    // Elo from engine A's mean score, with the error margin of the mean;
+    // a score of 0 or 1 is taken as half a game less extreme
+    int wins = counts[2], draws = counts[1], losses = counts[0];
+    double score = (wins + 0.5 * draws) / num_games;
+    double variance = (wins * (1 - score) * (1 - score)
+        + draws * (0.5 - score) * (0.5 - score)
+        + losses * score * score) / num_games;
+    double margin = Z_95 * sqrt(variance / num_games);
+    double bounds[3] = {score - margin, score, score + margin};
+    double elo[3];
+    for (int i=0; i<3; i++) {
+        double p = bounds[i];
+        double min_p = 0.5 / num_games;
+        p = p < min_p ? min_p : (p > 1 - min_p ? 1 - min_p : p);
+        elo[i] = -ELO_SCALE * log10(1 / p - 1);
+    }
+    double los = wins + losses ?
+        0.5 * (1 + erf((wins - losses) / sqrt(2.0 * (wins + losses)))) : 0.5;
+    printf("{\"games\": %d, \"engine_a\": \"%s\", \"engine_b\": \"%s\", "
+        "\"wins\": %d, \"draws\": %d, \"losses\": %d, \"score\": %.4f, "
+        "\"elo\": %.1f, \"elo_margin\": %.1f, \"los\": %.4f, "
+        "\"threads\": %d, \"time_ms\": %.3f, \"games_per_sec\": %.1f}\n",
+        num_games, tournament.engines[0].spec, tournament.engines[1].spec,
+        wins, draws, losses, score, elo[1], (elo[2] - elo[0]) / 2, los,
+        options->threads, time_ms,
+        time_ms > 0 ? num_games / time_ms * 1000 : 0.0);
+    free(tournament.games);
+    return EXIT_SUCCESS;
+}
+
+/* Sets up `engine` from its `spec`: the search options of an engine in this
+    process (`options` if empty), or the command of an engine process, which
+    is started with pipes to its stdin and stdout. Returns FALSE if the
+    options are not valid search options or the process cannot be started.
+*/
+int
+open_engine(engine_t *engine, char *spec, options_t *options) {
+    engine->spec = spec;
+    engine->requests = engine->replies = NULL;
+    engine->is_reading = engine->has_ended = FALSE;
+    memset(engine->has_reply, 0, sizeof(engine->has_reply));
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->replied, NULL);
+    engine->options = *options;
+    engine->options.threads = 1;    // games are played side by side instead
+    engine->options.command = NULL;
+
+    // options for this process are read like the command line's
+    char *text = strdup(spec);
+    assert(text!=NULL);
+    char *rest;
+    int argc = 1;
+    engine->argv[0] = text;
+    char *token = strtok_r(text, TOKEN_DELIMITERS, &rest);
+    if (!token) {
+        return TRUE;
+    }
+    if (token[0] == DASH) {
+        for (; token && argc<MAX_ENGINE_ARGS;
+            token=strtok_r(NULL, TOKEN_DELIMITERS, &rest)) {
+            if (token[0] == DASH && !is_engine_option(token)) {
+                return FALSE;   // it would apply to the whole process
+            }
+            engine->argv[argc++] = token;
+        }
+        engine->argv[argc] = NULL;
+        return !token && read_options(argc, engine->argv, &engine->options)
+            && !engine->options.command;
+    }
+    free(text);
+
+    // an engine process that ends must not end this one
+    signal(SIGPIPE, SIG_IGN);
+    int requests[2], replies[2];
+    if (pipe(requests) < 0 || pipe(replies) < 0) {
+        return FALSE;
+    }
+    engine->pid = fork();
+    if (engine->pid < 0) {
+        return FALSE;
+    }
+    if (engine->pid == 0) {
+        dup2(requests[0], STDIN_FILENO);
+        dup2(replies[1], STDOUT_FILENO);
+        close(requests[0]);
+        close(requests[1]);
+        close(replies[0]);
+        close(replies[1]);
+        execl(ENGINE_SHELL, ENGINE_SHELL, "-c", spec, (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(requests[0]);
+    close(replies[1]);
+    engine->requests = fdopen(requests[1], "w");
+    engine->replies = fdopen(replies[0], "r");
+    return engine->requests && engine->replies;
+}
+
+/* Returns TRUE if the `option` of an engine spec applies to that engine's
+    searches alone. The others (eg. the hash size, endgame database or
+    book) are set for the whole process by the command line.
+*/
+int
+is_engine_option(char *option) {
+    return strcmp(option, OPT_DEPTH) == 0 || strcmp(option, OPT_TIME) == 0
+        || strcmp(option, OPT_NODES) == 0
+        || strcmp(option, OPT_QUIESCENCE) == 0;
+}
+
+/* Ends the engine process of `engine` (if any) and frees its options.
+*/
+void
+close_engine(engine_t *engine) {
+    if (engine->requests) {
+        fclose(engine->requests);   // the end of its input ends the process
+        fclose(engine->replies);
+        waitpid(engine->pid, NULL, 0);
+    } else {
+        free(engine->argv[0]);
+    }
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->replied);
+}
+
+/* Plays the games of the tournament `arg` until none are left. Each thread
+    has its own session number in engine processes.
+*/
+void
+*tournament_worker(void *arg) {
+    tournament_t *tournament = (tournament_t*)arg;
+    int slot = atomic_fetch_add(&tournament->next_slot, 1);
+    int index;
+    while ((index = atomic_fetch_add(&tournament->next, 1))
+        < tournament->num_games) {
+        play_match_game(tournament, index, slot, &tournament->games[index]);
+    }
+    return NULL;
+}
+
+/* Plays game `index` of the tournament and stores its result in `game`. Both
+    games of an opening start with the same OPENING_PLIES random actions;
+    engine A plays black in the even game and white in the odd one. Like
+    mode 1, the game ends when the side to move has no valid action or a
+    search finds a forced win. It is drawn once only towers have stepped for
+    DRAW_PLIES plies in a row, since towers can move back and forth forever.
+*/
+void
+play_match_game(tournament_t *tournament, int index, int slot,
+    match_game_t *game) {
+    board_t board;
+    fill_initial_board(&board);
+    int player = BLACK;
+    uint64_t state = ZOBRIST_SEED * (index/2 + 1);
+    move_t moves[MAX_MOVES];
+    for (int ply=0; ply<OPENING_PLIES; ply++) {
+        int num_moves = get_valid_actions(&board, player, moves);
+        move_t move = moves[next_random(&state) % num_moves];
+        move_to_action(move, game->opening[ply]);
+        undo_t undo;
+        make_move(&board, move, player, &undo);
+        player = !player;
+    }
+
+    // engine A plays black in even games
+    engine_t *engines[NUM_PLAYERS];
+    engines[BLACK] = &tournament->engines[index % 2];
+    engines[WHITE] = &tournament->engines[1 - index % 2];
+    search_memory_t memories[NUM_PLAYERS];
+    memset(memories, 0, sizeof(memories));
+    int winner = NO_WINNER, quiet_plies = 0;
+    game->plies = OPENING_PLIES;
+    game->end = END_DRAW_RULE;
+    while (quiet_plies < DRAW_PLIES) {
+        int num_moves = get_valid_actions(&board, player, moves);
+        if (!num_moves) {
+            winner = !player;
+            game->end = END_NO_ACTIONS;
+            break;
+        }
+        int cost;
+        move_t move = engine_move(engines[player], slot, &board, player,
+            &memories[player], &cost);
+        if (cost == INT_MAX || cost == INT_MIN) {
+            winner = cost == INT_MAX ? BLACK : WHITE;
+            game->end = END_SEARCH;
+            break;
+        }
+
+        // a build being compared may be buggy, so its action is checked
+        int is_legal = FALSE;
+        for (int i=0; i<num_moves && !is_legal; i++) {
+            is_legal = moves[i] == move;
+        }
+        if (!is_legal) {
+            winner = !player;
+            game->end = END_ILLEGAL;
+            break;
+        }
+
+        // only tower steps make no progress towards the end of the game
+        int is_quiet = !is_capture(move)
+            && (board.towers[player] & SQUARE_BIT(MOVE_SRC(move)));
+        quiet_plies = is_quiet ? quiet_plies + 1 : 0;
+        undo_t undo;
+        make_move(&board, move, player, &undo);
+        player = !player;
+        game->plies++;
+    }
+    if (winner == NO_WINNER) {
+        game->result = 1;
     } else {
-        list->foot->next = new;
-        list->foot = new;
+        game->result = engines[winner] == &tournament->engines[0] ? 2 : 0;
     }
-    return list;
 }
 
-/* Free the memory alocated to `list`.
-    Adapted version of the free_list function by Alistair Moffat:
-    https://people.eng.unimelb.edu.au/ammoffat/ppsaa/c/listops.c
+/* Returns the action `engine` plays on the `board`, and its cost in `cost`.
+    An engine in this process searches with its own `memory`; an engine
+    process is sent the board and a go request on session number `slot`.
+    An engine process's action is not checked to be valid, and NO_MOVE is
+    returned if it does not name two checkered cells.
+*/
+move_t
+engine_move(engine_t *engine, int slot, board_t *board, int player,
+    search_memory_t *memory, int *cost) {
+    if (!engine->requests) {
+        node_t *best_action = iterative_deepening(board, player,
+            &engine->options, memory, NULL);
+        move_t move = action_to_move(best_action->action);
+        *cost = best_action->cost;
+        free(best_action);
+        return move;
+    }
+
+    char request[SERVER_REPLY_LEN], reply[SERVER_REPLY_LEN];
+    char cells[NUM_SQUARES+1];
+    for (int sq=0; sq<NUM_SQUARES; sq++) {
+        int row = sq / SQUARES_PER_ROW;
+        cells[sq] = get_cell(board, row, sq % SQUARES_PER_ROW * 2
+            + (row + 1) % 2);
+    }
+    cells[NUM_SQUARES] = '\0';
+    snprintf(request, SERVER_REPLY_LEN, "%d set-position %s %c\n", slot,
+        cells, player == BLACK ? CELL_BPIECE : CELL_WPIECE);
+    engine_request(engine, slot, request, reply);
+    snprintf(request, SERVER_REPLY_LEN, "%d go\n", slot);
+    engine_request(engine, slot, request, reply);
+    char action[ACTION_LEN+2];
+    if (sscanf(reply, "%*d bestmove %5s cost %d", action, cost) != 2
+        || strlen(action) != ACTION_LEN+1) {
+        *cost = player == BLACK ? INT_MIN : INT_MAX;   // no (valid) action
+        return NO_MOVE;
+    }
+    action_t compact = {action[0], action[1], action[3], action[4], '\0'};
+    move_t move = action_to_move(compact);
+    action_t written;
+    move_to_action(move, written);
+    return strcmp(written, compact) == 0 ? move : NO_MOVE;
+}
+
+/* Sends `request` to the engine process of `engine` and stores the reply of
+    session number `slot` in `reply`. Replies come back in any order, so the
+    thread reading them hands the others to their threads.
+*/
+void
+engine_request(engine_t *engine, int slot, char *request, char *reply) {
+    pthread_mutex_lock(&engine->lock);
+    fputs(request, engine->requests);
+    fflush(engine->requests);
+    while (!engine->has_reply[slot]) {
+        if (engine->is_reading) {
+            pthread_cond_wait(&engine->replied, &engine->lock);
+            continue;
+        }
+        engine->is_reading = TRUE;
+        pthread_mutex_unlock(&engine->lock);
+        char line[SERVER_REPLY_LEN];
+        int other = -1;
+        int has_ended = !fgets(line, SERVER_REPLY_LEN, engine->replies);
+        if (has_ended) {
+            strcpy(line, "error engine ended\n");
+            other = slot;
+        } else if (sscanf(line, "%d", &other) != 1 || other < 0
+            || other >= MAX_THREADS) {
+            other = slot;   // a reply without a session is taken as ours
+        }
+        pthread_mutex_lock(&engine->lock);
+        engine->is_reading = FALSE;
+        engine->has_ended |= has_ended;
+        strcpy(engine->reply[other], line);
+        engine->has_reply[other] = TRUE;
+        pthread_cond_broadcast(&engine->replied);
+    }
+    strcpy(reply, engine->reply[slot]);
+    engine->has_reply[slot] = FALSE;
+    pthread_mutex_unlock(&engine->lock);
+}
+
+/* Prints game `index` of a tournament to `stream` as one JSON object.
+*/
+void
+print_match_game(FILE *stream, int index, match_game_t *game) {
+    static const char *result_names[] = RESULT_NAMES;
+    static const char *end_names[] = END_NAMES;
+    fprintf(stream, "{\"game\": %d, \"engine_a\": \"%s\", \"opening\": [",
+        index, index % 2 ? "white" : "black");
+    for (int i=0; i<OPENING_PLIES; i++) {
+        fprintf(stream, "%s\"%c%c-%c%c\"", i ? ", " : "",
+            game->opening[i][SRC_COL], game->opening[i][SRC_ROW],
+            game->opening[i][TAR_COL], game->opening[i][TAR_ROW]);
+    }
+    fprintf(stream, "], \"result\": \"%s\", \"end\": \"%s\", "
+        "\"plies\": %d}\n", result_names[game->result],
+        end_names[game->end], game->plies);
+}
+
+/* Returns the next pseudo-random number of the splitmix64 generator with
+    `state`.
+*/
+uint64_t
+next_random(uint64_t *state) {
+    *state += ZOBRIST_SEED;
+    uint64_t key = *state;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+/* ---------------------------- Memory Functions ---------------------------- */
+
+/* Creates and returns a new node.
+*/
+node_t
+*create_new_node(char *action) {
+    node_t* new = (node_t*)counted_malloc(sizeof(node_t));
+    strcpy(new->action, action);
+    return new;
+}
+
+/* Allocates `size` bytes and counts the allocation on this thread, so the
+    number of allocations made while searching can be reported.
 */
 void
-free_list(list_t *list) {
-	node_t *curr, *prev;
-	assert(list!=NULL);
-	curr = list->head;
-	while (curr) {
-		prev = curr;
-		curr = curr->next;
-		free(prev);
-	}
-	free(list);
+*counted_malloc(size_t size) {
+    thread_allocations++;
+    void *ptr = malloc(size);
+    assert(ptr!=NULL);
+    return ptr;
 }
 
 /* THE END -------------------------------------------------------------------*/